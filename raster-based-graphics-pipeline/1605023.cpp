@@ -1,25 +1,97 @@
 #include<iostream>
 #include<fstream>
+#include<sstream>
 #include<iomanip>
 #include<cmath>
 #include<string>
 #include<cstdlib>
-#include<stack>
 #include<ctime>
 #include<limits>
-
-/*
-    You will find "bitmap_image.hpp" from the following link:
-    https://drive.google.com/file/d/14eOfsMpwIuh8G_Wy6BSjNX6VXFRA9eSM/view?usp=sharing
-*/
-
-#include "bitmap_image.hpp"
+#include<vector>
+#include<map>
+#include<cstring>
+#include<stdint.h>
+#include<thread>
+#include<atomic>
+#include<algorithm>
+#include<chrono>
+#include<future>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<memory>
+#include<random>
+#include<csignal>
+#include<sys/stat.h>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include<immintrin.h>
+#endif
+
+#ifndef _WIN32
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<glob.h>
+#include<sys/resource.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#endif
+
+#include "image_writer.hpp"
 
 using namespace std;
 
 #define PI 2.0*acos(0.0)
 #define INF numeric_limits<double>::infinity()
 
+#if defined(__AVX__)
+/* SIMD lanes of doubles: 4 per vector with AVX, 2 per vector with SSE2 */
+struct DoubleLanes {
+    typedef __m256d Vector;
+    static const int width = 4;
+
+    static Vector broadcast(double value) { return _mm256_set1_pd(value); }
+    static Vector laneOffsets() { return _mm256_set_pd(3.0, 2.0, 1.0, 0.0); }
+    static Vector add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+    static Vector multiply(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+    static Vector divide(Vector a, Vector b) { return _mm256_div_pd(a, b); }
+    static Vector greater(Vector a, Vector b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static Vector less(Vector a, Vector b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static Vector equal(Vector a, Vector b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static Vector notGreaterEqual(Vector a, Vector b) { return _mm256_cmp_pd(a, b, _CMP_NGE_UQ); }
+    static Vector bitAnd(Vector a, Vector b) { return _mm256_and_pd(a, b); }
+    static Vector bitOr(Vector a, Vector b) { return _mm256_or_pd(a, b); }
+    static Vector select(Vector mask, Vector a, Vector b) { return _mm256_blendv_pd(b, a, mask); }
+    static Vector load(const double* address) { return _mm256_loadu_pd(address); }
+    static void store(double* address, Vector value) { _mm256_storeu_pd(address, value); }
+    static int moveMask(Vector mask) { return _mm256_movemask_pd(mask); }
+    static void storeLanes(double* values, Vector value) { _mm256_storeu_pd(values, value); }
+};
+#elif defined(__SSE2__)
+struct DoubleLanes {
+    typedef __m128d Vector;
+    static const int width = 2;
+
+    static Vector broadcast(double value) { return _mm_set1_pd(value); }
+    static Vector laneOffsets() { return _mm_set_pd(1.0, 0.0); }
+    static Vector add(Vector a, Vector b) { return _mm_add_pd(a, b); }
+    static Vector multiply(Vector a, Vector b) { return _mm_mul_pd(a, b); }
+    static Vector divide(Vector a, Vector b) { return _mm_div_pd(a, b); }
+    static Vector greater(Vector a, Vector b) { return _mm_cmpgt_pd(a, b); }
+    static Vector less(Vector a, Vector b) { return _mm_cmplt_pd(a, b); }
+    static Vector equal(Vector a, Vector b) { return _mm_cmpeq_pd(a, b); }
+    static Vector notGreaterEqual(Vector a, Vector b) { return _mm_cmpnge_pd(a, b); }
+    static Vector bitAnd(Vector a, Vector b) { return _mm_and_pd(a, b); }
+    static Vector bitOr(Vector a, Vector b) { return _mm_or_pd(a, b); }
+    static Vector select(Vector mask, Vector a, Vector b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+    static Vector load(const double* address) { return _mm_loadu_pd(address); }
+    static void store(double* address, Vector value) { _mm_storeu_pd(address, value); }
+    static int moveMask(Vector mask) { return _mm_movemask_pd(mask); }
+    static void storeLanes(double* values, Vector value) { _mm_storeu_pd(values, value); }
+};
+#endif
+
 class Point {
     double x;
     double y;
@@ -149,6 +221,14 @@ public:
         generateIdentityMatrix();
     }
 
+    Transformation(const double* values) {
+        memcpy(matrix, values, sizeof(matrix));
+    }
+
+    void copyMatrix(double* values) const {
+        memcpy(values, matrix, sizeof(matrix));
+    }
+
     void generateTranslationMatrix(double, double, double);
     void generateScalingMatrix(double, double, double);
     void generateRotationMatrix(double, double, double, double);
@@ -157,6 +237,7 @@ public:
 
     Transformation operator*(const Transformation);
     Point operator*(const Point);
+    Transformation inverse() const;
 
     ~Transformation() {
         generateIdentityMatrix();
@@ -295,453 +376,5778 @@ Point Transformation::operator*(const Point point) {
     return Point(temp[0], temp[1], temp[2], temp[3]);
 }
 
-struct Color {
-    int redValue;
-    int greenValue;
-    int blueValue;
-};
+Transformation Transformation::inverse() const {
+    /* Gauss-Jordan elimination with partial pivoting; a singular matrix yields a matrix of NaNs */
+    double a[4][8];
 
-struct Triangle {
-    Point corners[3];
-    Color rgb;
-};
+    for(int i=0; i<4; i++) {
+        for(int j=0; j<4; j++) {
+            a[i][j] = matrix[i][j];
+            a[i][j+4] = (i == j)? 1.0: 0.0;
+        }
+    }
 
-int main(int argc, char** argv) {
-    ifstream input;
-    ofstream output;
+    for(int column=0; column<4; column++) {
+        int pivot = column;
+        for(int i=column+1; i<4; i++) {
+            if(fabs(a[i][column]) > fabs(a[pivot][column])) {
+                pivot = i;
+            }
+        }
+        for(int j=0; j<8; j++) {
+            swap(a[column][j], a[pivot][j]);
+        }
 
-    /* setting test case directory name */
-    string testCaseDir = "1";
+        double scale = 1.0/a[column][column];
+        for(int j=0; j<8; j++) {
+            a[column][j] *= scale;
+        }
 
-    /* preparing input for extracting values from scene.txt */
-    input.open("./test-cases/"+testCaseDir+"/scene.txt");
-    if(!input.is_open()) {
-        exit(EXIT_FAILURE);
+        for(int i=0; i<4; i++) {
+            if(i != column) {
+                double factor = a[i][column];
+                for(int j=0; j<8; j++) {
+                    a[i][j] -= factor*a[column][j];
+                }
+            }
+        }
     }
 
-    /* extracting gluLookAt & gluPerspective function parameters from scene.txt */
-    double eyeX, eyeY, eyeZ;
-    double lookX, lookY, lookZ;
-    double upX, upY, upZ;
-    double fovY, aspectRatio, near, far;
+    Transformation temp;
+    for(int i=0; i<4; i++) {
+        for(int j=0; j<4; j++) {
+            temp.matrix[i][j] = a[i][j+4];
+        }
+    }
+    return temp;
+}
 
-    input >> eyeX >> eyeY >> eyeZ;
-    input >> lookX >> lookY >> lookZ;
-    input >> upX >> upY >> upZ;
-    input >> fovY >> aspectRatio >> near >> far;
+/*
+    stack of affine transformations used while parsing scene.txt; only top 3 rows of every 4x4 matrix are
+    stored (bottom row is always 0 0 0 1) & translate, scale & rotate are composed into top in place.
+    push only makes new level share its parent's matrix, which is copied on first change, so push & pop
+    move indices only
+*/
 
-    /* stage1: modeling transformation by analyzing display code */
-    string command;
+#define AFFINE_MATRIX_SIZE 12
 
-    stack<Transformation> transformationMatrixStack;
-    transformationMatrixStack.push(Transformation());
+class AffineTransformationStack {
+    vector<double> matrices;  // slot i is owned by level i
+    vector<int> levelSlots;   // slot holding matrix of every level
 
-    output.open("./test-cases/"+testCaseDir+"/stage1.txt");
-    if(!output.is_open()) {
-        exit(EXIT_FAILURE);
+    double* getTop() {
+        int level = (int) levelSlots.size() - 1;
+
+        /* copy on write: level still sharing its parent's matrix gets its own slot now */
+        if(levelSlots[level] != level) {
+            memcpy(&matrices[AFFINE_MATRIX_SIZE*level], &matrices[AFFINE_MATRIX_SIZE*levelSlots[level]], sizeof(double)*AFFINE_MATRIX_SIZE);
+            levelSlots[level] = level;
+        }
+        return &matrices[AFFINE_MATRIX_SIZE*level];
     }
 
-    bool bInvalidCommandEncountered, bPopOnEmptyStack;
-    bInvalidCommandEncountered = bPopOnEmptyStack = false;
+public:
+    AffineTransformationStack() {
+        matrices.assign(AFFINE_MATRIX_SIZE, 0.0);
+        matrices[0] = matrices[5] = matrices[10] = 1.0;
+        levelSlots.push_back(0);
+    }
 
-    int triangleCounter, pushCounter;
-    triangleCounter = pushCounter = 0;
+    int getDepth() const {
+        return (int) levelSlots.size() - 1;
+    }
 
-    while(true) {
-        input >> command;
+    void push() {
+        int parentSlot = levelSlots.back();
+
+        levelSlots.push_back(parentSlot);
+        if(matrices.size() < AFFINE_MATRIX_SIZE*levelSlots.size()) {
+            matrices.resize(2*AFFINE_MATRIX_SIZE*levelSlots.size());
+        }
+    }
 
-        if(command.compare("triangle") == 0) {
-            Point p1, p2, p3;
+    void pop() {
+        levelSlots.pop_back();
+    }
 
-            input >> p1;
-            input >> p2;
-            input >> p3;
+    void translate(double tx, double ty, double tz) {
+        double* top = getTop();
 
-            p1 = transformationMatrixStack.top()*p1;
-            p1.scale();
-            p2 = transformationMatrixStack.top()*p2;
-            p2.scale();
-            p3 = transformationMatrixStack.top()*p3;
-            p3.scale();
+        for(int i=0; i<3; i++) {
+            double* row = top + 4*i;
+            row[3] = row[0]*tx + row[1]*ty + row[2]*tz + row[3];
+        }
+    }
 
-            output << p1 << endl;
-            output << p2 << endl;
-            output << p3 << endl;
-            output << endl;
+    void scale(double sx, double sy, double sz) {
+        double* top = getTop();
 
-            triangleCounter++;
-        } else if(command.compare("translate") == 0) {
-            double tx, ty, tz;
-            input >> tx >> ty >> tz;
+        for(int i=0; i<3; i++) {
+            double* row = top + 4*i;
 
-            Transformation translationTransformation;
-            translationTransformation.generateTranslationMatrix(tx, ty, tz);
+            row[0] *= sx;
+            row[1] *= sy;
+            row[2] *= sz;
+        }
+    }
 
-            Transformation temp = transformationMatrixStack.top()*translationTransformation;
-            transformationMatrixStack.pop();
-            transformationMatrixStack.push(temp);
-        } else if(command.compare("scale") == 0) {
-            double sx, sy, sz;
-            input >> sx >> sy >> sz;
+    void rotate(double angle, double ax, double ay, double az) {
+        double rotation[16];
 
-            Transformation scalingTransformation;
-            scalingTransformation.generateScalingMatrix(sx, sy, sz);
+        Transformation rotationTransformation;
+        rotationTransformation.generateRotationMatrix(angle, ax, ay, az);
+        rotationTransformation.copyMatrix(rotation);
 
-            Transformation temp = transformationMatrixStack.top()*scalingTransformation;
-            transformationMatrixStack.pop();
-            transformationMatrixStack.push(temp);
-        } else if(command.compare("rotate") == 0) {
-            double angle, ax, ay, az;
-            input >> angle >> ax >> ay >> az;
+        double* top = getTop();
 
-            Transformation rotationTransformation;
-            rotationTransformation.generateRotationMatrix(angle, ax, ay, az);
+        for(int i=0; i<3; i++) {
+            double* row = top + 4*i;
+            double temp[3];
 
-            Transformation temp = transformationMatrixStack.top()*rotationTransformation;
-            transformationMatrixStack.pop();
-            transformationMatrixStack.push(temp);
-        } else if(command.compare("push") == 0) {
-            Transformation temp;
-            temp = temp*transformationMatrixStack.top();
-            transformationMatrixStack.push(temp);
-            pushCounter++;
-        } else if(command.compare("pop") == 0) {
-            if(pushCounter == 0) {
-                cout << command << ": pop on empty stack" << endl;
-                bPopOnEmptyStack = true;
-                break;
+            for(int j=0; j<3; j++) {
+                temp[j] = row[0]*rotation[j] + row[1]*rotation[4 + j] + row[2]*rotation[8 + j];
             }
-
-            transformationMatrixStack.pop();
-            pushCounter--;
-        } else if(command.compare("end") == 0) {
-            break;
-        } else {
-            cout << command << ": invalid command encountered" << endl;
-            bInvalidCommandEncountered = true;
-            break;
+            row[0] = temp[0];
+            row[1] = temp[1];
+            row[2] = temp[2];
         }
     }
-    input.close();
-    output.close();
 
-    if(bInvalidCommandEncountered) {
-        exit(EXIT_FAILURE);
-    }
+    void copyMatrix(double* values) const {
+        /* writes top as full 4x4 row major matrix */
+        memcpy(values, &matrices[AFFINE_MATRIX_SIZE*levelSlots.back()], sizeof(double)*AFFINE_MATRIX_SIZE);
 
-    if(bPopOnEmptyStack) {
-        exit(EXIT_FAILURE);
+        values[12] = values[13] = values[14] = 0.0;
+        values[15] = 1.0;
     }
+};
 
-    /* stage2: view transformation */
-    Transformation viewTransformation;
-    viewTransformation.generateViewMatrix(Point(eyeX, eyeY, eyeZ), Point(lookX, lookY, lookZ), Point(upX, upY, upZ));
+struct Color {
+    int redValue;
+    int greenValue;
+    int blueValue;
+};
 
-    input.open("./test-cases/"+testCaseDir+"/stage1.txt");
-    if(!input.is_open()) {
-        exit(EXIT_FAILURE);
-    }
+/* random colors come from a generator owned by one render job, never from rand() shared by concurrent jobs */
+typedef mt19937 ColorGenerator;
+
+Color getRandomColor(ColorGenerator& generator) {
+    Color color;
+    color.redValue = generator()%256;
+    color.greenValue = generator()%256;
+    color.blueValue = generator()%256;
+    return color;
+}
+
+struct Triangle {
+    Point corners[3];
+    Color rgb;
+    uint32_t id;  // index among drawn scene triangles, shared by pieces of a clipped triangle
+};
 
-    output.open("./test-cases/"+testCaseDir+"/stage2.txt");
+void writeStageFile(string fileName, vector<Triangle>& triangles) {
+    /* debug dump of a stage's triangle batch in the stage*.txt text format */
+    ofstream output(fileName.c_str());
     if(!output.is_open()) {
         exit(EXIT_FAILURE);
     }
 
-    for(int i=0; i<triangleCounter; i++) {
-        Point p1, p2, p3;
-
-        input >> p1;
-        input >> p2;
-        input >> p3;
-
-        p1 = viewTransformation*p1;
-        p1.scale();
-        p2 = viewTransformation*p2;
-        p2.scale();
-        p3 = viewTransformation*p3;
-        p3.scale();
-
-        output << p1 << endl;
-        output << p2 << endl;
-        output << p3 << endl;
-        output << endl;
+    for(size_t i=0; i<triangles.size(); i++) {
+        output << triangles[i].corners[0] << '\n';
+        output << triangles[i].corners[1] << '\n';
+        output << triangles[i].corners[2] << '\n';
+        output << '\n';
     }
-    input.close();
     output.close();
+}
 
-    /* stage3: projection transformation */
-    Transformation projectionTransformation;
-    projectionTransformation.generateProjectionMatrix(fovY, aspectRatio, near, far);
-
-    input.open("./test-cases/"+testCaseDir+"/stage2.txt");
-    if(!input.is_open()) {
-        exit(EXIT_FAILURE);
-    }
-
-    output.open("./test-cases/"+testCaseDir+"/stage3.txt");
-    if(!output.is_open()) {
-        exit(EXIT_FAILURE);
+void transformTriangles(vector<Triangle>& triangles, Transformation transformation) {
+    /* applying transformation on triangle batch in place */
+    for(size_t i=0; i<triangles.size(); i++) {
+        for(int j=0; j<3; j++) {
+            triangles[i].corners[j] = transformation*triangles[i].corners[j];
+            triangles[i].corners[j].scale();
+        }
     }
+}
 
-    for(int i=0; i<triangleCounter; i++) {
-        Point p1, p2, p3;
+/*
+    scene.bin layout (native endianness, written by --compile-scene):
+        - SceneFileHeader
+        - matrixCount composed 4x4 model matrices (row major doubles)
+        - meshTriangleCount*9 object space corner coordinates (doubles)
+        - indexedVertexCount*3 object space vertex coordinates of imported meshes (doubles)
+        - drawCount SceneDraw records
+        - indexedTriangleCount*3 vertex indices of imported meshes (uint32_t)
+
+    every draw renders a range of stored triangles under one model matrix; inline triangles sharing a matrix
+    form one draw, while every "instance" of a defined mesh adds a draw over the mesh's stored triangles.
+    draws of imported meshes (vertexCount > 0) refer to indexed triangles instead, whose indices are
+    relative to firstVertex, so that every vertex is transformed once per draw
+*/
 
-        input >> p1;
-        input >> p2;
-        input >> p3;
+#define SCENE_FILE_MAGIC 0x4e424353u  // "SCBN"
+#define SCENE_FILE_VERSION 3u
 
-        p1 = projectionTransformation*p1;
-        p1.scale();
-        p2 = projectionTransformation*p2;
-        p2.scale();
-        p3 = projectionTransformation*p3;
-        p3.scale();
+struct Camera {
+    double eyeX, eyeY, eyeZ;
+    double lookX, lookY, lookZ;
+    double upX, upY, upZ;
+    double fovY, aspectRatio, near, far;
+};
 
-        output << p1 << endl;
-        output << p2 << endl;
-        output << p3 << endl;
-        output << endl;
-    }
-    input.close();
-    output.close();
+struct SceneFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t triangleCount;
+    uint32_t meshTriangleCount;
+    uint32_t matrixCount;
+    uint32_t drawCount;
+    uint32_t indexedVertexCount;
+    uint32_t indexedTriangleCount;
+    Camera camera;
+};
 
-    /* stage4: clipping & scan conversion using z-buffer algorithm */
+struct SceneDraw {
+    uint32_t firstTriangle;
+    uint32_t triangleCount;
+    uint32_t matrixIndex;
+    uint32_t firstVertex;
+    uint32_t vertexCount;  // 0 for draws of stored (non-indexed) triangles
+};
 
-    /* reading values from config.txt */
-    input.open("./test-cases/"+testCaseDir+"/config.txt");
-    if(!input.is_open()) {
-        exit(EXIT_FAILURE);
+struct Scene {
+    Camera camera;
+
+    uint32_t triangleCount;  // drawn triangles, i.e. summed over all draws
+    uint32_t meshTriangleCount;  // stored triangles
+    uint32_t matrixCount;
+    uint32_t drawCount;
+    uint32_t indexedVertexCount;
+    uint32_t indexedTriangleCount;
+
+    /* flattened arrays, pointing either into owned storage or into mapped scene.bin */
+    const double* matrices;
+    const double* vertices;
+    const SceneDraw* draws;
+    const double* indexedVertices;
+    const uint32_t* indices;
+
+    vector<double> matrixStorage;
+    vector<double> vertexStorage;
+    vector<SceneDraw> drawStorage;
+    vector<double> indexedVertexStorage;
+    vector<uint32_t> indexStorage;
+    vector<char> fileStorage;
+
+    void* mappedAddress;
+    size_t mappedLength;
+
+    Scene() {
+        triangleCount = meshTriangleCount = matrixCount = drawCount = 0;
+        indexedVertexCount = indexedTriangleCount = 0;
+        matrices = vertices = indexedVertices = NULL;
+        draws = NULL;
+        indices = NULL;
+        mappedAddress = NULL;
+        mappedLength = 0;
     }
 
-    int screenWidth, screenHeight;
-    double leftLimitX, rightLimitX, bottomLimitY, topLimitY, frontLimitZ, rearLimitZ;
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
 
-    input >> screenWidth >> screenHeight;
-    input >> leftLimitX;
-    input >> bottomLimitY;
-    input >> frontLimitZ >> rearLimitZ;
+    ~Scene() {
+#ifndef _WIN32
+        if(mappedAddress != NULL) {
+            munmap(mappedAddress, mappedLength);
+        }
+#endif
+    }
+};
 
-    input.close();
+/*
+    mesh import: vertex positions & triangle vertex indices (0 based, relative to the file's first vertex)
+    of Wavefront OBJ & binary PLY files; polygons are triangulated as fans
+*/
 
-    rightLimitX = -leftLimitX;
-    topLimitY = -bottomLimitY;
+bool appendPolygon(vector<uint32_t>& polygon, uint32_t vertexCount, vector<uint32_t>& indices) {
+    for(size_t i=0; i<polygon.size(); i++) {
+        if(polygon[i] >= vertexCount) {
+            return false;
+        }
+    }
+    for(size_t i=1; i+1<polygon.size(); i++) {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[i]);
+        indices.push_back(polygon[i + 1]);
+    }
+    return true;
+}
 
-    /* reading values from stage3.txt */
-    input.open("./test-cases/"+testCaseDir+"/stage3.txt");
+bool readObjFile(string fileName, vector<double>& vertices, vector<uint32_t>& indices) {
+    ifstream input(fileName.c_str());
     if(!input.is_open()) {
-        exit(EXIT_FAILURE);
+        cout << fileName << ": cannot open mesh" << endl;
+        return false;
     }
 
-    Triangle triangles[triangleCounter];
-    srand(time(0));
+    size_t firstVertex = vertices.size()/3;
+    string line;
+    vector<uint32_t> polygon;
 
-    for(int i=0; i<triangleCounter; i++) {
-        input >> triangles[i].corners[0];
-        input >> triangles[i].corners[1];
-        input >> triangles[i].corners[2];
+    while(getline(input, line)) {
+        istringstream fields(line);
+        string keyword;
+        fields >> keyword;
 
-        triangles[i].rgb.redValue = rand()%256;
-        triangles[i].rgb.greenValue = rand()%256;
-        triangles[i].rgb.blueValue = rand()%256;
+        if(keyword.compare("v") == 0) {
+            double x, y, z;
+            if(!(fields >> x >> y >> z)) {
+                cout << fileName << ": invalid vertex \"" << line << "\"" << endl;
+                return false;
+            }
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+        } else if(keyword.compare("f") == 0) {
+            /* corners look like v, v/vt, v//vn or v/vt/vn; negative v counts back from last vertex */
+            uint32_t vertexCount = (uint32_t) (vertices.size()/3 - firstVertex);
+            string corner;
+            polygon.clear();
+
+            bool bValid = true;
+
+            while(bValid && fields >> corner) {
+                long long index = strtoll(corner.c_str(), NULL, 10);
+
+                /* 0 & indices beyond vertices read so far (in either direction) are invalid */
+                bValid = index!=0 && index<=(long long) vertexCount && index>=-(long long) vertexCount;
+                if(bValid) {
+                    polygon.push_back(index>0? (uint32_t) (index - 1): (uint32_t) (vertexCount + index));
+                }
+            }
+            if(!bValid || polygon.size()<3 || !appendPolygon(polygon, vertexCount, indices)) {
+                cout << fileName << ": invalid face \"" << line << "\"" << endl;
+                return false;
+            }
+        }
+        /* normals, texture coordinates, groups, materials etc. are ignored */
     }
-    input.close();
+    return true;
+}
 
-    /* initializing z-buffer & frame buffer */
-    double dx, dy, topY, bottomY, leftX, rightX;
+struct PlyProperty {
+    string name;
+    string type;
+    string countType;  // non-empty for list properties
+};
 
-    dx = (rightLimitX - leftLimitX)/screenWidth;
-    dy = (topLimitY - bottomLimitY)/screenHeight;
-    topY = topLimitY - dy/2.0;
-    bottomY = bottomLimitY + dy/2.0;
-    leftX = leftLimitX + dx/2.0;
-    rightX = rightLimitX - dx/2.0;
+int getPlyTypeSize(string type) {
+    if(type=="char" || type=="uchar" || type=="int8" || type=="uint8") {
+        return 1;
+    } else if(type=="short" || type=="ushort" || type=="int16" || type=="uint16") {
+        return 2;
+    } else if(type=="int" || type=="uint" || type=="int32" || type=="uint32" || type=="float" || type=="float32") {
+        return 4;
+    } else if(type=="double" || type=="float64") {
+        return 8;
+    }
+    return 0;
+}
 
-    /*
-        How do I declare a 2d array in c++ using new?
-        Link: https://stackoverflow.com/questions/936687/how-do-i-declare-a-2d-array-in-c-using-new/
-    */
+double readPlyValue(const unsigned char* data, string type, bool bSwapBytes) {
+    unsigned char bytes[8];
+    int size = getPlyTypeSize(type);
 
-    double** zBuffer = new double*[screenHeight];
-    for(int i=0; i<screenHeight; i++) {
-        zBuffer[i] = new double[screenWidth];
+    for(int i=0; i<size; i++) {
+        bytes[i] = data[bSwapBytes? size-1-i: i];
     }
 
-    for(int row=0; row<screenHeight; row++) {
-        for(int column=0; column<screenWidth; column++) {
-            zBuffer[row][column] = rearLimitZ;
-        }
+    if(type=="char" || type=="int8") {
+        return *(int8_t*) bytes;
+    } else if(type=="uchar" || type=="uint8") {
+        return *(uint8_t*) bytes;
+    } else if(type=="short" || type=="int16") {
+        int16_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    } else if(type=="ushort" || type=="uint16") {
+        uint16_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    } else if(type=="int" || type=="int32") {
+        int32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    } else if(type=="uint" || type=="uint32") {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    } else if(type=="float" || type=="float32") {
+        float value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
     }
+    double value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
 
-    Color** frameBuffer = new Color*[screenHeight];
-    for(int i=0; i<screenHeight; i++) {
-        frameBuffer[i] = new Color[screenWidth];
+bool readPlyFile(string fileName, vector<double>& vertices, vector<uint32_t>& indices) {
+    /* binary (little or big endian) PLY with "vertex" (x, y, z) & "face" (vertex_indices list) elements */
+    ifstream input(fileName.c_str(), ios::in | ios::binary);
+    if(!input.is_open()) {
+        cout << fileName << ": cannot open mesh" << endl;
+        return false;
     }
 
-    for(int row=0; row<screenHeight; row++) {
-        for(int column=0; column<screenWidth; column++) {
-            frameBuffer[row][column].redValue = 0;
-            frameBuffer[row][column].greenValue = 0;
-            frameBuffer[row][column].blueValue = 0;
-        }
+    string line, keyword;
+    vector<string> elementNames;
+    vector<uint32_t> elementCounts;
+    vector< vector<PlyProperty> > elementProperties;
+    bool bSwapBytes = false;
+
+    getline(input, line);
+    if(line.compare(0, 3, "ply") != 0) {
+        cout << fileName << ": not a PLY file" << endl;
+        return false;
     }
 
-    /* applying procedure */
-    for(int i=0, topScanline, bottomScanline; i<triangleCounter; i++) {
-        /* finding topScanline & bottomScanline after necessary clipping */
-        double maxY = max(triangles[i].corners[0].getY(), max(triangles[i].corners[1].getY(), triangles[i].corners[2].getY()));
-        double minY = min(triangles[i].corners[0].getY(), min(triangles[i].corners[1].getY(), triangles[i].corners[2].getY()));
+    while(getline(input, line)) {
+        istringstream fields(line);
+        fields >> keyword;
 
-        if(maxY >= topY) {
-            topScanline = 0;
-        } else {
-            topScanline = (int) round((topY - maxY)/dy);
-        }
-        if(minY <= bottomY) {
-            bottomScanline = screenHeight - 1;
-        } else {
-            bottomScanline = screenHeight - (1 + ((int) round((minY - bottomY)/dy)));
-        }
+        if(keyword.compare("format") == 0) {
+            string format;
+            fields >> format;
 
-        /* scanning from topScanline to bottomScanline (inclusive) */
-        for(int row=topScanline, leftIntersectingColumn, rightIntersectingColumn; row<=bottomScanline; row++) {
-            /* defining three intersecting points on triangle's three sides */
-            double ys = topY - row*dy;
+            uint16_t probe = 1;
+            bool bLittleEndianHost = *(unsigned char*) &probe == 1;
 
-            Point intersectingPoints[3];
-            intersectingPoints[0] = Point(INF, ys, 0, 1);
-            intersectingPoints[1] = Point(INF, ys, 1, 2);
-            intersectingPoints[2] = Point(INF, ys, 2, 0);
+            if(format.compare("binary_little_endian") == 0) {
+                bSwapBytes = !bLittleEndianHost;
+            } else if(format.compare("binary_big_endian") == 0) {
+                bSwapBytes = bLittleEndianHost;
+            } else {
+                cout << fileName << ": " << format << " PLY is not supported" << endl;
+                return false;
+            }
+        } else if(keyword.compare("element") == 0) {
+            string name;
+            uint32_t count;
+            fields >> name >> count;
+
+            elementNames.push_back(name);
+            elementCounts.push_back(count);
+            elementProperties.push_back(vector<PlyProperty>());
+        } else if(keyword.compare("property")==0 && !elementProperties.empty()) {
+            PlyProperty property;
+            fields >> property.type;
+
+            if(property.type.compare("list") == 0) {
+                fields >> property.countType >> property.type;
+            }
+            fields >> property.name;
 
-            /* determining intersecting points' x value (if any) */
-            for(int j=0; j<3; j++) {
-                Point p1 = triangles[i].corners[(int) intersectingPoints[j].getZ()];
-                Point p2 = triangles[i].corners[(int) intersectingPoints[j].getW()];
+            if(getPlyTypeSize(property.type)==0 || (!property.countType.empty() && getPlyTypeSize(property.countType)==0)) {
+                cout << fileName << ": invalid property \"" << line << "\"" << endl;
+                return false;
+            }
+            elementProperties.back().push_back(property);
+        } else if(keyword.compare("end_header") == 0) {
+            break;
+        }
+    }
 
-                if(p1.getY() != p2.getY()) {
-                    intersectingPoints[j].setX(p1.getX() + (ys - p1.getY())*(p1.getX() - p2.getX())/(p1.getY() - p2.getY()));
+    /* bytes of element data left, so that list counts can be checked before reading */
+    streampos dataStart = input.tellg();
+    input.seekg(0, ios::end);
+    uint64_t remaining = (dataStart==streampos(-1) || input.tellg()<dataStart)? 0: (uint64_t) (input.tellg() - dataStart);
+    input.seekg(dataStart);
+
+    size_t firstVertex = vertices.size()/3;
+    uint32_t vertexCount = 0;
+    vector<unsigned char> data(256);
+    vector<uint32_t> polygon;
+
+    for(size_t e=0; e<elementNames.size(); e++) {
+        vector<PlyProperty>& properties = elementProperties[e];
+        bool bVertex = elementNames[e].compare("vertex") == 0;
+        bool bFace = elementNames[e].compare("face") == 0;
+
+        for(uint32_t item=0; item<elementCounts[e]; item++) {
+            double position[3] = {0.0, 0.0, 0.0};
+            polygon.clear();
+
+            for(size_t k=0; k<properties.size(); k++) {
+                PlyProperty& property = properties[k];
+                int size = getPlyTypeSize(property.type);
+
+                if(property.countType.empty()) {
+                    if((uint64_t) size>remaining || !input.read((char*) &data[0], size)) {
+                        cout << fileName << ": truncated PLY file" << endl;
+                        return false;
+                    }
+                    remaining -= size;
+                    if(bVertex) {
+                        double value = readPlyValue(&data[0], property.type, bSwapBytes);
+
+                        if(property.name.compare("x") == 0) {
+                            position[0] = value;
+                        } else if(property.name.compare("y") == 0) {
+                            position[1] = value;
+                        } else if(property.name.compare("z") == 0) {
+                            position[2] = value;
+                        }
+                    }
+                    continue;
                 }
-            }
 
-            /* filtering out all invalid points (if any) */
-            for(int j=0; j<3; j++) {
-                Point p1 = triangles[i].corners[(int) intersectingPoints[j].getZ()];
-                Point p2 = triangles[i].corners[(int) intersectingPoints[j].getW()];
+                int countSize = getPlyTypeSize(property.countType);
+                if((uint64_t) countSize>remaining || !input.read((char*) &data[0], countSize)) {
+                    cout << fileName << ": truncated PLY file" << endl;
+                    return false;
+                }
+                remaining -= countSize;
 
-                if(intersectingPoints[j].getX() != INF) {
-                    if(intersectingPoints[j].getX()>max(p1.getX(), p2.getX()) || intersectingPoints[j].getX()<min(p1.getX(), p2.getX()) || intersectingPoints[j].getY()>max(p1.getY(), p2.getY()) || intersectingPoints[j].getY()<min(p1.getY(), p2.getY())) {
-                        intersectingPoints[j].setX(INF);
-                    }
+                /* list must fit into data left, which also bounds the buffer below */
+                double countValue = readPlyValue(&data[0], property.countType, bSwapBytes);
+                if(!(countValue>=0.0 && countValue<=(double) (remaining/size))) {
+                    cout << fileName << ": bad PLY list count " << countValue << endl;
+                    return false;
                 }
-            }
 
-            /* finding out leftIntersecting & rightIntersecting points */
-            int maxIndex, minIndex;
-            maxIndex = minIndex = -1;
+                uint32_t count = (uint32_t) countValue;
+                data.resize(max(data.size(), (size_t) count*size));
+
+                if(count>0 && !input.read((char*) &data[0], (size_t) count*size)) {
+                    cout << fileName << ": truncated PLY file" << endl;
+                    return false;
+                }
+                remaining -= (uint64_t) count*size;
 
-            double maxX, minX;
+                if(bFace && (property.name.compare("vertex_indices")==0 || property.name.compare("vertex_index")==0)) {
+                    for(uint32_t i=0; i<count; i++) {
+                        double index = readPlyValue(&data[(size_t) i*size], property.type, bSwapBytes);
 
-            for(int j=0; j<3; j++) {
-                if(maxIndex==-1 && minIndex==-1) {
-                    if(intersectingPoints[j].getX() != INF) {
-                        maxIndex = minIndex = j;
-                        maxX = minX = intersectingPoints[j].getX();
-                    }
-                } else {
-                    if(intersectingPoints[j].getX() != INF) {
-                        if(intersectingPoints[j].getX() < minX) {
-                            minIndex = j;
-                            minX = intersectingPoints[j].getX();
-                        }
-                        if(intersectingPoints[j].getX() > maxX) {
-                            maxIndex = j;
-                            maxX = intersectingPoints[j].getX();
+                        /* checked before conversion, since negative or huge values cannot be represented */
+                        if(!(index>=0.0 && index<(double) vertexCount)) {
+                            cout << fileName << ": invalid face " << item << endl;
+                            return false;
                         }
+                        polygon.push_back((uint32_t) index);
                     }
                 }
             }
 
-            /* finding leftIntersectingColumn & rightIntersectingColumn after necessary clipping */
-            if(intersectingPoints[minIndex].getX() <= leftX) {
-                leftIntersectingColumn = 0;
-            } else {
-                leftIntersectingColumn = (int) round((intersectingPoints[minIndex].getX() - leftX)/dx);
-            }
-            if(intersectingPoints[maxIndex].getX() >= rightX) {
-                rightIntersectingColumn = screenWidth - 1;
-            } else {
-                rightIntersectingColumn = screenWidth - (1 + ((int) round((rightX - intersectingPoints[maxIndex].getX())/dx)));
+            if(bVertex) {
+                vertices.insert(vertices.end(), position, position+3);
+                vertexCount++;
+            } else if(bFace && !polygon.empty()) {
+                if(polygon.size()<3 || !appendPolygon(polygon, vertexCount, indices)) {
+                    cout << fileName << ": invalid face " << item << endl;
+                    return false;
+                }
             }
+        }
+    }
+
+    if(vertices.size()/3 - firstVertex != vertexCount) {
+        return false;
+    }
+    return true;
+}
+
+bool readMeshFile(string fileName, vector<double>& vertices, vector<uint32_t>& indices) {
+    string extension = fileName.substr(fileName.find_last_of('.') + 1);
 
-            /* determining za & zb values */
-            Point p1 = triangles[i].corners[(int) intersectingPoints[minIndex].getZ()];
-            Point p2 = triangles[i].corners[(int) intersectingPoints[minIndex].getW()];
+    for(size_t i=0; i<extension.size(); i++) {
+        extension[i] = (char) tolower(extension[i]);
+    }
 
-            double za = p1.getZ() + (intersectingPoints[minIndex].getY() - p1.getY())*(p2.getZ() - p1.getZ())/(p2.getY() - p1.getY());
+    if(extension.compare("obj") == 0) {
+        return readObjFile(fileName, vertices, indices);
+    } else if(extension.compare("ply") == 0) {
+        return readPlyFile(fileName, vertices, indices);
+    }
+    cout << fileName << ": unsupported mesh format" << endl;
+    return false;
+}
 
-            p1 = triangles[i].corners[(int) intersectingPoints[maxIndex].getZ()];
-            p2 = triangles[i].corners[(int) intersectingPoints[maxIndex].getW()];
+struct SceneMesh {
+    uint32_t firstTriangle;
+    uint32_t triangleCount;
+    uint32_t firstVertex;
+    uint32_t vertexCount;  // 0 for meshes of stored (non-indexed) triangles
+};
 
-            double zb = p1.getZ() + (intersectingPoints[maxIndex].getY() - p1.getY())*(p2.getZ() - p1.getZ())/(p2.getY() - p1.getY());
+bool parseScene(istream& input, Scene& scene, string sceneDir) {
+    /* parsing scene.txt into flattened vertices & pre-composed model matrices */
 
-            /* scanning from leftIntersectingColumn to rightIntersectingColumn (inclusive) */
-            double zp;
-            double constantTerm = dx*(zb - za)/(intersectingPoints[maxIndex].getX() - intersectingPoints[minIndex].getX());
+    /* extracting gluLookAt & gluPerspective function parameters from scene.txt */
+    Camera& camera = scene.camera;
 
-            for(int column=leftIntersectingColumn; column<=rightIntersectingColumn; column++) {
-                /* calculating z value */
-                if(column == leftIntersectingColumn) {
-                    zp = za + ((leftX + leftIntersectingColumn*dx) - intersectingPoints[minIndex].getX())*(zb - za)/(intersectingPoints[maxIndex].getX()- intersectingPoints[minIndex].getX());
-                } else {
-                    zp = zp + constantTerm;
+    input >> camera.eyeX >> camera.eyeY >> camera.eyeZ;
+    input >> camera.lookX >> camera.lookY >> camera.lookZ;
+    input >> camera.upX >> camera.upY >> camera.upZ;
+    input >> camera.fovY >> camera.aspectRatio >> camera.near >> camera.far;
+
+    /* analyzing display code */
+    string command;
+
+    AffineTransformationStack transformationStack;
+
+    /* top of stack is appended to matrixStorage lazily, once a triangle or an instance refers to it */
+    bool bTopMatrixStored = false;
+
+    /* meshes declared by "define NAME ... enddefine" or imported by "import NAME FILE" */
+    map<string, SceneMesh> meshes;
+    string meshName;
+    bool bDefiningMesh = false;
+    uint32_t meshFirstTriangle = 0;
+
+    while(true) {
+        input >> command;
+
+        if(!input) {
+            cout << "scene ended without end command" << endl;
+            return false;
+        }
+
+        if(bDefiningMesh && command.compare("triangle")!=0 && command.compare("enddefine")!=0) {
+            cout << command << ": only triangles are allowed inside define" << endl;
+            return false;
+        }
+
+        if(command.compare("triangle")==0 || command.compare("instance")==0) {
+            SceneMesh mesh;
+
+            if(command.compare("triangle") == 0) {
+                mesh.firstTriangle = (uint32_t) (scene.vertexStorage.size()/9);
+                mesh.triangleCount = 1;
+                mesh.firstVertex = mesh.vertexCount = 0;
+
+                for(int j=0; j<9; j++) {
+                    double value;
+                    input >> value;
+                    scene.vertexStorage.push_back(value);
                 }
 
-                /* comparing computed z value with current value in zBuffer[row][column] & frontLimitZ and updating zBuffer[row][column] & frameBuffer[row][column] if necessary */
-                if(zp>frontLimitZ && zp<zBuffer[row][column]) {
-                    zBuffer[row][column] = zp;
+                /* mesh triangles are drawn by instances only */
+                if(bDefiningMesh) {
+                    continue;
+                }
+            } else {
+                string name;
+                input >> name;
 
-                    frameBuffer[row][column].redValue = triangles[i].rgb.redValue;
-                    frameBuffer[row][column].greenValue = triangles[i].rgb.greenValue;
-                    frameBuffer[row][column].blueValue = triangles[i].rgb.blueValue;
+                map<string, SceneMesh>::iterator definedMesh = meshes.find(name);
+                if(definedMesh == meshes.end()) {
+                    cout << name << ": instance of undefined mesh" << endl;
+                    return false;
                 }
+                mesh = definedMesh->second;
             }
-        }
-    }
 
-    /* saving outputs */
-    bitmap_image bitmapImage(screenWidth, screenHeight);
+            if(!bTopMatrixStored) {
+                double values[16];
+                transformationStack.copyMatrix(values);
+                scene.matrixStorage.insert(scene.matrixStorage.end(), values, values+16);
+                bTopMatrixStored = true;
+            }
+            uint32_t matrixIndex = (uint32_t) (scene.matrixStorage.size()/16 - 1);
 
-    for(int row=0; row<screenHeight; row++) {
-        for(int column=0; column<screenWidth; column++) {
-            bitmapImage.set_pixel(column, row, frameBuffer[row][column].redValue, frameBuffer[row][column].greenValue, frameBuffer[row][column].blueValue);
-        }
-    }
-    bitmapImage.save_image("./test-cases/"+testCaseDir+"/out.bmp");
+            /* drawn triangles are counted (& indexed) in 32 bits, as in scene.bin */
+            if((uint64_t) scene.triangleCount+mesh.triangleCount > UINT32_MAX) {
+                cout << command << ": scene draws more than " << UINT32_MAX << " triangles" << endl;
+                return false;
+            }
 
-    output.open("./test-cases/"+testCaseDir+"/z-buffer.txt");
-    if(!output.is_open()) {
-        exit(EXIT_FAILURE);
-    }
+            /* extending last draw if it covers preceding stored triangles under same matrix */
+            SceneDraw* lastDraw = scene.drawStorage.empty()? NULL: &scene.drawStorage.back();
+
+            if(lastDraw!=NULL && lastDraw->vertexCount==0 && mesh.vertexCount==0 && lastDraw->matrixIndex==matrixIndex && lastDraw->firstTriangle+lastDraw->triangleCount==mesh.firstTriangle) {
+                lastDraw->triangleCount += mesh.triangleCount;
+            } else if(mesh.triangleCount > 0) {
+                SceneDraw draw;
+                draw.firstTriangle = mesh.firstTriangle;
+                draw.triangleCount = mesh.triangleCount;
+                draw.matrixIndex = matrixIndex;
+                draw.firstVertex = mesh.firstVertex;
+                draw.vertexCount = mesh.vertexCount;
+                scene.drawStorage.push_back(draw);
+            }
+            scene.triangleCount += mesh.triangleCount;
+        } else if(command.compare("import") == 0) {
+            /* mesh file path is relative to scene directory */
+            string fileName;
+            input >> meshName >> fileName;
+
+            if(meshes.find(meshName) != meshes.end()) {
+                cout << meshName << ": mesh defined twice" << endl;
+                return false;
+            }
+
+            SceneMesh mesh;
+            mesh.firstTriangle = (uint32_t) (scene.indexStorage.size()/3);
+            mesh.firstVertex = (uint32_t) (scene.indexedVertexStorage.size()/3);
 
-    for(int row=0; row<screenHeight; row++) {
-        for(int column=0; column<screenWidth; column++) {
-            if(zBuffer[row][column] < rearLimitZ) {
-                output << zBuffer[row][column] << '\t';
+            if(!readMeshFile(sceneDir.empty()? fileName: sceneDir+"/"+fileName, scene.indexedVertexStorage, scene.indexStorage)) {
+                return false;
             }
-        }
-        output << endl;
-    }
-    output.close();
+            mesh.triangleCount = (uint32_t) (scene.indexStorage.size()/3) - mesh.firstTriangle;
+            mesh.vertexCount = (uint32_t) (scene.indexedVertexStorage.size()/3) - mesh.firstVertex;
+
+            meshes[meshName] = mesh;
+        } else if(command.compare("define") == 0) {
+            input >> meshName;
+
+            if(meshes.find(meshName) != meshes.end()) {
+                cout << meshName << ": mesh defined twice" << endl;
+                return false;
+            }
+            bDefiningMesh = true;
+            meshFirstTriangle = (uint32_t) (scene.vertexStorage.size()/9);
+        } else if(command.compare("enddefine") == 0) {
+            if(!bDefiningMesh) {
+                cout << command << ": no mesh being defined" << endl;
+                return false;
+            }
+            SceneMesh mesh;
+            mesh.firstTriangle = meshFirstTriangle;
+            mesh.triangleCount = (uint32_t) (scene.vertexStorage.size()/9) - meshFirstTriangle;
+            mesh.firstVertex = mesh.vertexCount = 0;
 
-    /* freeing memory */
-    for(int i=0; i<screenHeight; i++) {
-        delete[] zBuffer[i];
+            meshes[meshName] = mesh;
+            bDefiningMesh = false;
+        } else if(command.compare("translate") == 0) {
+            double tx, ty, tz;
+            input >> tx >> ty >> tz;
+
+            transformationStack.translate(tx, ty, tz);
+            bTopMatrixStored = false;
+        } else if(command.compare("scale") == 0) {
+            double sx, sy, sz;
+            input >> sx >> sy >> sz;
+
+            transformationStack.scale(sx, sy, sz);
+            bTopMatrixStored = false;
+        } else if(command.compare("rotate") == 0) {
+            double angle, ax, ay, az;
+            input >> angle >> ax >> ay >> az;
+
+            transformationStack.rotate(angle, ax, ay, az);
+            bTopMatrixStored = false;
+        } else if(command.compare("push") == 0) {
+            transformationStack.push();
+            bTopMatrixStored = false;
+        } else if(command.compare("pop") == 0) {
+            if(transformationStack.getDepth() == 0) {
+                cout << command << ": pop on empty stack" << endl;
+                return false;
+            }
+
+            transformationStack.pop();
+            bTopMatrixStored = false;
+        } else if(command.compare("end") == 0) {
+            break;
+        } else {
+            cout << command << ": invalid command encountered" << endl;
+            return false;
+        }
+    }
+
+    scene.meshTriangleCount = (uint32_t) (scene.vertexStorage.size()/9);
+    scene.matrixCount = (uint32_t) (scene.matrixStorage.size()/16);
+    scene.drawCount = (uint32_t) scene.drawStorage.size();
+    scene.matrices = scene.matrixStorage.empty()? NULL: &scene.matrixStorage[0];
+    scene.vertices = scene.vertexStorage.empty()? NULL: &scene.vertexStorage[0];
+    scene.draws = scene.drawStorage.empty()? NULL: &scene.drawStorage[0];
+    scene.indexedVertexCount = (uint32_t) (scene.indexedVertexStorage.size()/3);
+    scene.indexedTriangleCount = (uint32_t) (scene.indexStorage.size()/3);
+    scene.indexedVertices = scene.indexedVertexStorage.empty()? NULL: &scene.indexedVertexStorage[0];
+    scene.indices = scene.indexStorage.empty()? NULL: &scene.indexStorage[0];
+
+    return true;
+}
+
+bool parseSceneFile(string fileName, Scene& scene) {
+    ifstream input(fileName.c_str());
+    if(!input.is_open()) {
+        return false;
+    }
+
+    size_t separator = fileName.find_last_of('/');
+    return parseScene(input, scene, separator==string::npos? "": fileName.substr(0, separator));
+}
+
+bool writeSceneBinary(string fileName, Scene& scene) {
+    ofstream output(fileName.c_str(), ios::out | ios::binary);
+    if(!output.is_open()) {
+        return false;
+    }
+
+    SceneFileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+    header.triangleCount = scene.triangleCount;
+    header.meshTriangleCount = scene.meshTriangleCount;
+    header.matrixCount = scene.matrixCount;
+    header.drawCount = scene.drawCount;
+    header.indexedVertexCount = scene.indexedVertexCount;
+    header.indexedTriangleCount = scene.indexedTriangleCount;
+    header.camera = scene.camera;
+
+    output.write((const char*) &header, sizeof(header));
+    output.write((const char*) scene.matrices, sizeof(double)*16*scene.matrixCount);
+    output.write((const char*) scene.vertices, sizeof(double)*9*scene.meshTriangleCount);
+    output.write((const char*) scene.indexedVertices, sizeof(double)*3*scene.indexedVertexCount);
+    output.write((const char*) scene.draws, sizeof(SceneDraw)*scene.drawCount);
+    output.write((const char*) scene.indices, sizeof(uint32_t)*3*scene.indexedTriangleCount);
+    output.close();
+
+    return !output.fail();
+}
+
+bool checkSceneBinary(string fileName, const char* data, size_t length) {
+    /* header, file length & draws of scene.bin data, checked before any of it reaches a Scene */
+    const SceneFileHeader* header = (const SceneFileHeader*) data;
+
+    if(header->magic!=SCENE_FILE_MAGIC || header->version!=SCENE_FILE_VERSION) {
+        cout << fileName << ": unsupported scene binary" << endl;
+        return false;
+    }
+
+    size_t expectedLength = sizeof(SceneFileHeader) + sizeof(double)*16*header->matrixCount + sizeof(double)*9*header->meshTriangleCount + sizeof(double)*3*header->indexedVertexCount + sizeof(SceneDraw)*header->drawCount + sizeof(uint32_t)*3*header->indexedTriangleCount;
+    if(length != expectedLength) {
+        cout << fileName << ": truncated scene binary" << endl;
+        return false;
+    }
+
+    const SceneDraw* draws = (const SceneDraw*) (data + expectedLength - sizeof(uint32_t)*3*header->indexedTriangleCount - sizeof(SceneDraw)*header->drawCount);
+    const uint32_t* indices = (const uint32_t*) (draws + header->drawCount);
+
+    /* draws (& indices of indexed ones) must stay inside stored arrays & add up to triangleCount */
+    uint64_t drawnTriangleCount = 0;
+
+    for(uint32_t i=0; i<header->drawCount; i++) {
+        const SceneDraw& draw = draws[i];
+        bool bValid = draw.matrixIndex < header->matrixCount;
+
+        if(draw.vertexCount == 0) {
+            bValid = bValid && (uint64_t) draw.firstTriangle+draw.triangleCount<=header->meshTriangleCount;
+        } else {
+            bValid = bValid && (uint64_t) draw.firstTriangle+draw.triangleCount<=header->indexedTriangleCount && (uint64_t) draw.firstVertex+draw.vertexCount<=header->indexedVertexCount;
+
+            for(uint64_t k=3*(uint64_t) draw.firstTriangle; bValid && k<3*((uint64_t) draw.firstTriangle+draw.triangleCount); k++) {
+                bValid = indices[k] < draw.vertexCount;
+            }
+        }
+
+        if(!bValid) {
+            cout << fileName << ": corrupt scene binary" << endl;
+            return false;
+        }
+        drawnTriangleCount += draw.triangleCount;
+    }
+    if(drawnTriangleCount != header->triangleCount) {
+        cout << fileName << ": corrupt scene binary" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool mapSceneBinary(string fileName, Scene& scene) {
+    /* mapping scene.bin into memory; arrays are used in place without any parsing & scene is left untouched on failure */
+    const char* data;
+    size_t length;
+
+#ifndef _WIN32
+    int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+    if(fileDescriptor == -1) {
+        return false;
+    }
+
+    struct stat fileStatus;
+    if(fstat(fileDescriptor, &fileStatus)==-1 || fileStatus.st_size<(off_t) sizeof(SceneFileHeader)) {
+        close(fileDescriptor);
+        return false;
+    }
+
+    length = (size_t) fileStatus.st_size;
+    void* address = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+
+    if(address == MAP_FAILED) {
+        return false;
+    }
+    data = (const char*) address;
+
+    if(!checkSceneBinary(fileName, data, length)) {
+        munmap(address, length);
+        return false;
+    }
+
+    scene.mappedAddress = address;
+    scene.mappedLength = length;
+#else
+    /* no mmap available, reading scene.bin into memory in one go instead */
+    ifstream input(fileName.c_str(), ios::in | ios::binary);
+    if(!input.is_open()) {
+        return false;
+    }
+
+    input.seekg(0, ios::end);
+    length = (size_t) input.tellg();
+    input.seekg(0, ios::beg);
+
+    if(length < sizeof(SceneFileHeader)) {
+        return false;
+    }
+
+    vector<char> fileStorage(length);
+    input.read(&fileStorage[0], length);
+
+    if(!checkSceneBinary(fileName, &fileStorage[0], length)) {
+        return false;
+    }
+
+    scene.fileStorage.swap(fileStorage);
+    data = &scene.fileStorage[0];
+#endif
+
+    const SceneFileHeader* header = (const SceneFileHeader*) data;
+
+    scene.camera = header->camera;
+    scene.triangleCount = header->triangleCount;
+    scene.meshTriangleCount = header->meshTriangleCount;
+    scene.matrixCount = header->matrixCount;
+    scene.drawCount = header->drawCount;
+    scene.indexedVertexCount = header->indexedVertexCount;
+    scene.indexedTriangleCount = header->indexedTriangleCount;
+    scene.matrices = (const double*) (data + sizeof(SceneFileHeader));
+    scene.vertices = scene.matrices + 16*scene.matrixCount;
+    scene.indexedVertices = scene.vertices + 9*scene.meshTriangleCount;
+    scene.draws = (const SceneDraw*) (scene.indexedVertices + 3*scene.indexedVertexCount);
+    scene.indices = (const uint32_t*) (scene.draws + scene.drawCount);
+
+    return true;
+}
+
+bool isSceneBinaryFresh(string textFileName, string binaryFileName) {
+    /* scene.bin is used only if it is not older than scene.txt */
+    struct stat textStatus, binaryStatus;
+
+    if(stat(binaryFileName.c_str(), &binaryStatus) != 0) {
+        return false;
+    }
+    if(stat(textFileName.c_str(), &textStatus) != 0) {
+        return true;
+    }
+    return binaryStatus.st_mtime >= textStatus.st_mtime;
+}
+
+bool loadScene(string sceneDir, Scene& scene) {
+    string textFileName = sceneDir+"/scene.txt";
+    string binaryFileName = sceneDir+"/scene.bin";
+
+    if(isSceneBinaryFresh(textFileName, binaryFileName) && mapSceneBinary(binaryFileName, scene)) {
+        return true;
+    }
+    return parseSceneFile(textFileName, scene);
+}
+
+void runModelingStage(Scene& scene, vector<Triangle>& triangles) {
+    /* stage1: applying pre-composed model matrices on flattened vertices */
+    triangles.resize(scene.triangleCount);
+
+    Transformation modelTransformation;
+    uint32_t currentMatrixIndex = scene.matrixCount;
+    uint32_t i = 0;
+
+    vector<Point> transformedVertices;
+
+    for(uint32_t d=0; d<scene.drawCount; d++) {
+        const SceneDraw& draw = scene.draws[d];
+
+        if(draw.matrixIndex != currentMatrixIndex) {
+            currentMatrixIndex = draw.matrixIndex;
+            modelTransformation = Transformation(scene.matrices+16*currentMatrixIndex);
+        }
+
+        if(draw.vertexCount > 0) {
+            /* indexed draw: transforming every vertex once, then assembling triangles from indices */
+            transformedVertices.resize(draw.vertexCount);
+
+            for(uint32_t v=0; v<draw.vertexCount; v++) {
+                const double* vertex = scene.indexedVertices+3*(draw.firstVertex + v);
+
+                transformedVertices[v] = modelTransformation*Point(vertex[0], vertex[1], vertex[2]);
+                transformedVertices[v].scale();
+            }
+
+            for(uint32_t t=0; t<draw.triangleCount; t++, i++) {
+                const uint32_t* indices = scene.indices+3*(draw.firstTriangle + t);
+
+                for(int j=0; j<3; j++) {
+                    triangles[i].corners[j] = transformedVertices[indices[j]];
+                }
+                triangles[i].id = i;
+            }
+            continue;
+        }
+
+        for(uint32_t t=0; t<draw.triangleCount; t++, i++) {
+            const double* corners = scene.vertices+9*(draw.firstTriangle + t);
+
+            for(int j=0; j<3; j++) {
+                triangles[i].corners[j] = modelTransformation*Point(corners[3*j], corners[3*j+1], corners[3*j+2]);
+                triangles[i].corners[j].scale();
+            }
+            triangles[i].id = i;
+        }
+    }
+}
+
+struct Config {
+    int screenWidth, screenHeight;
+    double leftLimitX, rightLimitX, bottomLimitY, topLimitY, frontLimitZ, rearLimitZ;
+
+    /* pixel spacing & centers of the outermost pixels */
+    double dx, dy, topY, bottomY, leftX, rightX;
+
+    /* samples per pixel: 1, or 2, 4 & 8 for multisample anti-aliasing */
+    int sampleCount;
+};
+
+#define MAX_SAMPLE_COUNT 8
+
+#define SCANLINE_RASTERIZER 0
+#define HALF_SPACE_RASTERIZER 1
+#define FIXED_POINT_RASTERIZER 2
+
+#define MAX_SUBPIXEL_BITS 16
+
+#define DEPTH_FORMAT_DOUBLE 0
+#define DEPTH_FORMAT_FLOAT32 1
+#define DEPTH_FORMAT_UNORM24 2
+
+/* faces culled at triangle setup; counter-clockwise triangles (on screen) face front */
+#define CULL_NONE 0
+#define CULL_BACK 1
+#define CULL_FRONT 2
+
+class WorkerPool;
+
+struct RasterOptions {
+    int rasterizer;
+    int depthFormat;
+    int threadCount;
+    int tileSize;
+    int subpixelBits;
+    int cullFaces;
+    bool bCullDegenerate;
+    bool bCullSmall;
+    bool bHierarchicalZ;
+    bool bFrontToBack;
+    bool bVisibilityBuffer;
+    WorkerPool* workerPool;  // persistent scan conversion threads (if any), spawned per frame otherwise
+
+    RasterOptions() {
+        rasterizer = SCANLINE_RASTERIZER;
+        depthFormat = DEPTH_FORMAT_DOUBLE;
+        threadCount = (int) thread::hardware_concurrency();
+        tileSize = 64;
+        subpixelBits = 8;
+        cullFaces = CULL_NONE;
+        bCullDegenerate = false;
+        bCullSmall = false;
+        bHierarchicalZ = true;
+        bFrontToBack = false;
+        bVisibilityBuffer = false;
+        workerPool = NULL;
+    }
+};
+
+void setUpConfig(Config& config) {
+    /* deriving symmetric limits, pixel spacing & centers of the outermost pixels */
+    config.rightLimitX = -config.leftLimitX;
+    config.topLimitY = -config.bottomLimitY;
+
+    config.dx = (config.rightLimitX - config.leftLimitX)/config.screenWidth;
+    config.dy = (config.topLimitY - config.bottomLimitY)/config.screenHeight;
+    config.topY = config.topLimitY - config.dy/2.0;
+    config.bottomY = config.bottomLimitY + config.dy/2.0;
+    config.leftX = config.leftLimitX + config.dx/2.0;
+    config.rightX = config.rightLimitX - config.dx/2.0;
+}
+
+bool readConfig(istream& input, Config& config, string sourceName) {
+    input >> config.screenWidth >> config.screenHeight;
+    input >> config.leftLimitX;
+    input >> config.bottomLimitY;
+    input >> config.frontLimitZ >> config.rearLimitZ;
+
+    if(!input || config.screenWidth<1 || config.screenHeight<1) {
+        cout << sourceName << ": invalid config" << endl;
+        return false;
+    }
+
+    /* optional sample count for multisample anti-aliasing */
+    if(!(input >> config.sampleCount)) {
+        config.sampleCount = 1;
+    }
+
+    if(config.sampleCount!=1 && config.sampleCount!=2 && config.sampleCount!=4 && config.sampleCount!=MAX_SAMPLE_COUNT) {
+        cout << sourceName << ": sample count must be 1, 2, 4 or 8" << endl;
+        return false;
+    }
+
+    setUpConfig(config);
+    return true;
+}
+
+bool readConfigFile(string fileName, Config& config) {
+    ifstream input(fileName.c_str());
+    if(!input.is_open()) {
+        return false;
+    }
+    return readConfig(input, config, fileName);
+}
+
+/*
+    clipping in homogeneous clip space (before perspective division)
+        - triangles entirely outside one side of the viewing volume given by config.txt are rejected
+        - triangles crossing frontLimitZ, rearLimitZ or eye plane are clipped against them
+        - x & y are clipped only against a guard band GUARD_BAND_FACTOR times as wide as the screen,
+          scan conversion takes care of the rest
+*/
+
+#define GUARD_BAND_FACTOR 16.0
+#define EYE_PLANE_EPSILON 1e-9
+#define MAX_CLIPPED_VERTICES 16
+
+#define CLIP_LEFT 1
+#define CLIP_RIGHT 2
+#define CLIP_BOTTOM 4
+#define CLIP_TOP 8
+#define CLIP_FRONT 16
+#define CLIP_REAR 32
+#define CLIP_EYE 64
+#define CLIP_GUARD_LEFT 128
+#define CLIP_GUARD_RIGHT 256
+#define CLIP_GUARD_BOTTOM 512
+#define CLIP_GUARD_TOP 1024
+#define CLIP_PLANE_COUNT 11
+
+#define REJECT_PLANES (CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_FRONT | CLIP_REAR | CLIP_EYE)
+#define CLIPPING_PLANES (CLIP_FRONT | CLIP_REAR | CLIP_EYE | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP)
+
+struct ClipCounters {
+    uint64_t trianglesRejected;
+    uint64_t trianglesClipped;
+    uint64_t trianglesClippedAway;
+
+    ClipCounters() {
+        trianglesRejected = trianglesClipped = trianglesClippedAway = 0;
+    }
+};
+
+double getPlaneDistance(Point& point, int plane, Config& config) {
+    /* signed distance of clip space point from plane, non-negative inside */
+    double x = point.getX(), y = point.getY(), z = point.getZ(), w = point.getW();
+
+    switch(plane) {
+        case CLIP_LEFT: return x - config.leftLimitX*w;
+        case CLIP_RIGHT: return config.rightLimitX*w - x;
+        case CLIP_BOTTOM: return y - config.bottomLimitY*w;
+        case CLIP_TOP: return config.topLimitY*w - y;
+        case CLIP_FRONT: return z - config.frontLimitZ*w;
+        case CLIP_REAR: return config.rearLimitZ*w - z;
+        case CLIP_EYE: return w - EYE_PLANE_EPSILON;
+        case CLIP_GUARD_LEFT: return x - GUARD_BAND_FACTOR*config.leftLimitX*w;
+        case CLIP_GUARD_RIGHT: return GUARD_BAND_FACTOR*config.rightLimitX*w - x;
+        case CLIP_GUARD_BOTTOM: return y - GUARD_BAND_FACTOR*config.bottomLimitY*w;
+        default: return GUARD_BAND_FACTOR*config.topLimitY*w - y;
+    }
+}
+
+int computeOutcode(Point& point, Config& config) {
+    int outcode = 0;
+
+    for(int plane=1; plane<(1<<CLIP_PLANE_COUNT); plane<<=1) {
+        if(!(getPlaneDistance(point, plane, config) >= 0.0)) {
+            outcode |= plane;
+        }
+    }
+    return outcode;
+}
+
+int clipPolygon(Point* polygon, int vertexCount, int plane, Config& config) {
+    /* Sutherland-Hodgman clipping of polygon against one plane, in place */
+    Point clipped[MAX_CLIPPED_VERTICES];
+    int clippedCount = 0;
+
+    for(int i=0; i<vertexCount; i++) {
+        Point& current = polygon[i];
+        Point& next = polygon[(i + 1)%vertexCount];
+
+        double currentDistance = getPlaneDistance(current, plane, config);
+        double nextDistance = getPlaneDistance(next, plane, config);
+
+        if(currentDistance >= 0.0) {
+            clipped[clippedCount++] = current;
+        }
+        if((currentDistance >= 0.0) != (nextDistance >= 0.0)) {
+            double t = currentDistance/(currentDistance - nextDistance);
+
+            clipped[clippedCount++] = Point(current.getX() + t*(next.getX() - current.getX()), current.getY() + t*(next.getY() - current.getY()), current.getZ() + t*(next.getZ() - current.getZ()), current.getW() + t*(next.getW() - current.getW()));
+        }
+    }
+
+    for(int i=0; i<clippedCount; i++) {
+        polygon[i] = clipped[i];
+    }
+    return clippedCount;
+}
+
+void appendProjectedTriangle(Point* polygon, int* outcodes, Color rgb, uint32_t id, Config& config, vector<Triangle>& projectedTriangles, ClipCounters& counters) {
+    /* polygon holds three clip space corners & has room for MAX_CLIPPED_VERTICES */
+
+    /* trivial reject: all corners outside same side of viewing volume */
+    if(outcodes[0] & outcodes[1] & outcodes[2] & REJECT_PLANES) {
+        counters.trianglesRejected++;
+        return;
+    }
+
+    /* clipping against planes crossed by triangle (if any) */
+    int vertexCount = 3;
+    int crossedPlanes = (outcodes[0] | outcodes[1] | outcodes[2]) & CLIPPING_PLANES;
+
+    for(int plane=1; plane<(1<<CLIP_PLANE_COUNT) && vertexCount>=3; plane<<=1) {
+        if(crossedPlanes & plane) {
+            vertexCount = clipPolygon(polygon, vertexCount, plane, config);
+        }
+    }
+
+    if(crossedPlanes != 0) {
+        counters.trianglesClipped++;
+        counters.trianglesClippedAway += vertexCount<3? 1: 0;
+    }
+
+    /* perspective division & fan triangulation of clipped polygon */
+    for(int j=0; j<vertexCount; j++) {
+        polygon[j].scale();
+    }
+
+    Triangle triangle;
+    triangle.rgb = rgb;
+    triangle.id = id;
+
+    for(int j=1; j+1<vertexCount; j++) {
+        triangle.corners[0] = polygon[0];
+        triangle.corners[1] = polygon[j];
+        triangle.corners[2] = polygon[j + 1];
+        projectedTriangles.push_back(triangle);
+    }
+}
+
+void runProjectionStage(vector<Triangle>& triangles, Transformation projectionTransformation, Config& config, bool bClipping, ClipCounters& counters) {
+    /* stage3: projection transformation, clipping & perspective division */
+    if(!bClipping) {
+        transformTriangles(triangles, projectionTransformation);
+        return;
+    }
+
+    vector<Triangle> projectedTriangles;
+    projectedTriangles.reserve(triangles.size());
+
+    for(size_t i=0; i<triangles.size(); i++) {
+        Point polygon[MAX_CLIPPED_VERTICES];
+        int outcodes[3];
+
+        for(int j=0; j<3; j++) {
+            polygon[j] = projectionTransformation*triangles[i].corners[j];
+            outcodes[j] = computeOutcode(polygon[j], config);
+        }
+        appendProjectedTriangle(polygon, outcodes, triangles[i].rgb, triangles[i].id, config, projectedTriangles, counters);
+    }
+    triangles.swap(projectedTriangles);
+}
+
+/*
+    fused stages 1-3: corners of consecutive triangles sharing a model matrix are gathered into
+    structure of arrays blocks, transformed by pre-multiplied P*V*M, classified against clipping planes
+    & divided by w in one SIMD pass; only triangles crossing a clipping plane take the Point based path
+*/
+
+#define TRANSFORM_BLOCK_SIZE 64
+
+struct CornerBlock {
+    double x[3*TRANSFORM_BLOCK_SIZE], y[3*TRANSFORM_BLOCK_SIZE], z[3*TRANSFORM_BLOCK_SIZE];
+    double clipX[3*TRANSFORM_BLOCK_SIZE], clipY[3*TRANSFORM_BLOCK_SIZE], clipZ[3*TRANSFORM_BLOCK_SIZE], clipW[3*TRANSFORM_BLOCK_SIZE];
+    double ndcX[3*TRANSFORM_BLOCK_SIZE], ndcY[3*TRANSFORM_BLOCK_SIZE], ndcZ[3*TRANSFORM_BLOCK_SIZE];
+    int outcodes[3*TRANSFORM_BLOCK_SIZE];
+};
+
+void buildClipPlanes(Config& config, double planes[CLIP_PLANE_COUNT][5]) {
+    /* plane i (bit 1<<i) as a*x + b*y + c*z + d*w + e, matching getPlaneDistance() */
+    double coefficients[CLIP_PLANE_COUNT][5] = {
+        {1.0, 0.0, 0.0, -config.leftLimitX, 0.0},
+        {-1.0, 0.0, 0.0, config.rightLimitX, 0.0},
+        {0.0, 1.0, 0.0, -config.bottomLimitY, 0.0},
+        {0.0, -1.0, 0.0, config.topLimitY, 0.0},
+        {0.0, 0.0, 1.0, -config.frontLimitZ, 0.0},
+        {0.0, 0.0, -1.0, config.rearLimitZ, 0.0},
+        {0.0, 0.0, 0.0, 1.0, -EYE_PLANE_EPSILON},
+        {1.0, 0.0, 0.0, -GUARD_BAND_FACTOR*config.leftLimitX, 0.0},
+        {-1.0, 0.0, 0.0, GUARD_BAND_FACTOR*config.rightLimitX, 0.0},
+        {0.0, 1.0, 0.0, -GUARD_BAND_FACTOR*config.bottomLimitY, 0.0},
+        {0.0, -1.0, 0.0, GUARD_BAND_FACTOR*config.topLimitY, 0.0}
+    };
+    memcpy(planes, coefficients, sizeof(coefficients));
+}
+
+void transformCornerBlock(CornerBlock& block, int cornerCount, double* matrix, double planes[CLIP_PLANE_COUNT][5]) {
+    int k = 0;
+
+#if defined(__AVX__) || defined(__SSE2__)
+    typedef DoubleLanes Lanes;
+    typedef Lanes::Vector Vector;
+
+    Vector m[16];
+    for(int i=0; i<16; i++) {
+        m[i] = Lanes::broadcast(matrix[i]);
+    }
+    Vector zero = Lanes::broadcast(0.0);
+
+    for(; k+Lanes::width<=cornerCount; k+=Lanes::width) {
+        Vector x = Lanes::load(block.x + k), y = Lanes::load(block.y + k), z = Lanes::load(block.z + k);
+        Vector clip[4];
+
+        for(int row=0; row<4; row++) {
+            clip[row] = Lanes::add(Lanes::add(Lanes::multiply(m[4*row], x), Lanes::multiply(m[4*row + 1], y)), Lanes::add(Lanes::multiply(m[4*row + 2], z), m[4*row + 3]));
+        }
+
+        Lanes::store(block.clipX + k, clip[0]);
+        Lanes::store(block.clipY + k, clip[1]);
+        Lanes::store(block.clipZ + k, clip[2]);
+        Lanes::store(block.clipW + k, clip[3]);
+
+        Lanes::store(block.ndcX + k, Lanes::divide(clip[0], clip[3]));
+        Lanes::store(block.ndcY + k, Lanes::divide(clip[1], clip[3]));
+        Lanes::store(block.ndcZ + k, Lanes::divide(clip[2], clip[3]));
+
+        int outcodes[Lanes::width] = {0};
+
+        for(int i=0; i<CLIP_PLANE_COUNT; i++) {
+            Vector distance = Lanes::add(Lanes::add(Lanes::multiply(Lanes::broadcast(planes[i][0]), clip[0]), Lanes::multiply(Lanes::broadcast(planes[i][1]), clip[1])), Lanes::add(Lanes::multiply(Lanes::broadcast(planes[i][2]), clip[2]), Lanes::multiply(Lanes::broadcast(planes[i][3]), clip[3])));
+            distance = Lanes::add(distance, Lanes::broadcast(planes[i][4]));
+
+            int bits = Lanes::moveMask(Lanes::notGreaterEqual(distance, zero));
+            for(int lane=0; lane<Lanes::width; lane++) {
+                if(bits & (1<<lane)) {
+                    outcodes[lane] |= 1<<i;
+                }
+            }
+        }
+
+        for(int lane=0; lane<Lanes::width; lane++) {
+            block.outcodes[k + lane] = outcodes[lane];
+        }
+    }
+#endif
+
+    for(; k<cornerCount; k++) {
+        double clip[4];
+
+        for(int row=0; row<4; row++) {
+            clip[row] = (matrix[4*row]*block.x[k] + matrix[4*row + 1]*block.y[k]) + (matrix[4*row + 2]*block.z[k] + matrix[4*row + 3]);
+        }
+
+        block.clipX[k] = clip[0];
+        block.clipY[k] = clip[1];
+        block.clipZ[k] = clip[2];
+        block.clipW[k] = clip[3];
+
+        block.ndcX[k] = clip[0]/clip[3];
+        block.ndcY[k] = clip[1]/clip[3];
+        block.ndcZ[k] = clip[2]/clip[3];
+
+        block.outcodes[k] = 0;
+        for(int i=0; i<CLIP_PLANE_COUNT; i++) {
+            double distance = (planes[i][0]*clip[0] + planes[i][1]*clip[1]) + (planes[i][2]*clip[2] + planes[i][3]*clip[3]) + planes[i][4];
+
+            if(!(distance >= 0.0)) {
+                block.outcodes[k] |= 1<<i;
+            }
+        }
+    }
+}
+
+void appendFusedTriangle(const CornerBlock* blocks[3], const int slots[3], Color rgb, uint32_t id, Config& config, bool bClipping, vector<Triangle>& triangles, ClipCounters& counters) {
+    /* corner j of triangle is at slot slots[j] of blocks[j] */
+    int outcodes[3];
+    for(int j=0; j<3; j++) {
+        outcodes[j] = blocks[j]->outcodes[slots[j]];
+    }
+
+    if(bClipping && ((outcodes[0] | outcodes[1] | outcodes[2]) & CLIPPING_PLANES)) {
+        Point polygon[MAX_CLIPPED_VERTICES];
+
+        for(int j=0; j<3; j++) {
+            int k = slots[j];
+            polygon[j] = Point(blocks[j]->clipX[k], blocks[j]->clipY[k], blocks[j]->clipZ[k], blocks[j]->clipW[k]);
+        }
+        appendProjectedTriangle(polygon, outcodes, rgb, id, config, triangles, counters);
+        return;
+    }
+    if(bClipping && (outcodes[0] & outcodes[1] & outcodes[2] & REJECT_PLANES)) {
+        counters.trianglesRejected++;
+        return;
+    }
+
+    /* trivially accepted (or clipping disabled): perspective division is already done */
+    Triangle triangle;
+    triangle.rgb = rgb;
+    triangle.id = id;
+
+    for(int j=0; j<3; j++) {
+        int k = slots[j];
+        triangle.corners[j] = Point(blocks[j]->ndcX[k], blocks[j]->ndcY[k], blocks[j]->ndcZ[k]);
+    }
+    triangles.push_back(triangle);
+}
+
+/* receives stage 3 output in chunks when stages 1-3 are streamed instead of collected (see TriangleBinner) */
+class TriangleSink {
+public:
+    virtual void consume(vector<Triangle>& triangles) = 0;
+
+    virtual ~TriangleSink() {
+    }
+};
+
+#define STREAM_CHUNK_TRIANGLES 65536
+
+void runFusedTransformStages(Scene& scene, Transformation viewTransformation, Transformation projectionTransformation, vector<Color>& colors, ColorGenerator& generator, Config& config, bool bClipping, vector<Triangle>& triangles, ClipCounters& counters, TriangleSink* sink) {
+    /*
+        with a sink, output is handed over whenever STREAM_CHUNK_TRIANGLES have been collected & triangles
+        is left holding the last partial chunk; empty colors gives triangles random colors of generator in drawing order
+    */
+    Transformation projectionViewTransformation = projectionTransformation*viewTransformation;
+
+    double planes[CLIP_PLANE_COUNT][5];
+    buildClipPlanes(config, planes);
+
+    triangles.clear();
+    triangles.reserve(sink==NULL? (size_t) scene.triangleCount: (size_t) STREAM_CHUNK_TRIANGLES + TRANSFORM_BLOCK_SIZE*MAX_CLIPPED_VERTICES);
+
+    vector<CornerBlock> blockStorage(1);
+    CornerBlock& block = blockStorage[0];
+
+    /* post-transform vertex cache of indexed draws, TRANSFORM_BLOCK_SIZE*3 vertices per block */
+    const uint32_t cacheBlockSize = 3*TRANSFORM_BLOCK_SIZE;
+    vector<CornerBlock> vertexCache;
+
+    double matrix[16];
+    uint32_t currentMatrixIndex = scene.matrixCount;
+
+    /* first is index of block's first triangle among drawn triangles, which colors are indexed by */
+    uint32_t first = 0;
+
+    for(uint32_t d=0; d<scene.drawCount; d++) {
+        const SceneDraw& draw = scene.draws[d];
+
+        if(draw.matrixIndex != currentMatrixIndex) {
+            currentMatrixIndex = draw.matrixIndex;
+            (projectionViewTransformation*Transformation(scene.matrices+16*currentMatrixIndex)).copyMatrix(matrix);
+        }
+
+        if(draw.vertexCount > 0) {
+            /* indexed draw: every vertex is transformed & classified once, triangles are assembled from cache */
+            vertexCache.resize(max(vertexCache.size(), (size_t) (draw.vertexCount + cacheBlockSize - 1)/cacheBlockSize));
+
+            for(uint32_t offset=0; offset<draw.vertexCount; offset+=cacheBlockSize) {
+                CornerBlock& cacheBlock = vertexCache[offset/cacheBlockSize];
+                int vertexCount = (int) min(cacheBlockSize, draw.vertexCount - offset);
+                const double* vertices = scene.indexedVertices + 3*(draw.firstVertex + offset);
+
+                for(int k=0; k<vertexCount; k++) {
+                    cacheBlock.x[k] = vertices[3*k];
+                    cacheBlock.y[k] = vertices[3*k + 1];
+                    cacheBlock.z[k] = vertices[3*k + 2];
+                }
+                transformCornerBlock(cacheBlock, vertexCount, matrix, planes);
+            }
+
+            for(uint32_t t=0; t<draw.triangleCount; t++) {
+                const uint32_t* indices = scene.indices + 3*(draw.firstTriangle + t);
+                const CornerBlock* blocks[3];
+                int slots[3];
+
+                for(int j=0; j<3; j++) {
+                    blocks[j] = &vertexCache[indices[j]/cacheBlockSize];
+                    slots[j] = (int) (indices[j]%cacheBlockSize);
+                }
+                appendFusedTriangle(blocks, slots, colors.empty()? getRandomColor(generator): colors[first + t], first + t, config, bClipping, triangles, counters);
+
+                if(sink!=NULL && triangles.size()>=STREAM_CHUNK_TRIANGLES) {
+                    sink->consume(triangles);
+                    triangles.clear();
+                }
+            }
+            first += draw.triangleCount;
+            continue;
+        }
+
+        for(uint32_t offset=0; offset<draw.triangleCount; offset+=TRANSFORM_BLOCK_SIZE) {
+            /* block of up to TRANSFORM_BLOCK_SIZE triangles of one draw */
+            int cornerCount = 3*min((uint32_t) TRANSFORM_BLOCK_SIZE, draw.triangleCount - offset);
+            const double* vertices = scene.vertices + 9*(draw.firstTriangle + offset);
+
+            for(int k=0; k<cornerCount; k++) {
+                block.x[k] = vertices[3*k];
+                block.y[k] = vertices[3*k + 1];
+                block.z[k] = vertices[3*k + 2];
+            }
+
+            transformCornerBlock(block, cornerCount, matrix, planes);
+
+            const CornerBlock* blocks[3] = {&block, &block, &block};
+
+            for(int t=0; t<cornerCount/3; t++) {
+                int slots[3] = {3*t, 3*t + 1, 3*t + 2};
+                appendFusedTriangle(blocks, slots, colors.empty()? getRandomColor(generator): colors[first + t], first + t, config, bClipping, triangles, counters);
+            }
+            first += cornerCount/3;
+
+            if(sink!=NULL && triangles.size()>=STREAM_CHUNK_TRIANGLES) {
+                sink->consume(triangles);
+                triangles.clear();
+            }
+        }
+    }
+}
+
+void runViewProjectionStages(vector<Triangle>& worldTriangles, Transformation viewTransformation, Transformation projectionTransformation, Config& config, bool bClipping, vector<Triangle>& triangles, ClipCounters& counters) {
+    /* stages 2-3 fused over resident world space triangles (carrying their colors), in blocks as in runFusedTransformStages() */
+    double matrix[16];
+    (projectionTransformation*viewTransformation).copyMatrix(matrix);
+
+    double planes[CLIP_PLANE_COUNT][5];
+    buildClipPlanes(config, planes);
+
+    triangles.clear();
+    triangles.reserve(worldTriangles.size());
+
+    vector<CornerBlock> blockStorage(1);
+    CornerBlock& block = blockStorage[0];
+    const CornerBlock* blocks[3] = {&block, &block, &block};
+
+    for(size_t first=0; first<worldTriangles.size(); first+=TRANSFORM_BLOCK_SIZE) {
+        int triangleCount = (int) min((size_t) TRANSFORM_BLOCK_SIZE, worldTriangles.size() - first);
+
+        for(int t=0; t<triangleCount; t++) {
+            for(int j=0; j<3; j++) {
+                Point& corner = worldTriangles[first + t].corners[j];
+
+                block.x[3*t + j] = corner.getX();
+                block.y[3*t + j] = corner.getY();
+                block.z[3*t + j] = corner.getZ();
+            }
+        }
+
+        transformCornerBlock(block, 3*triangleCount, matrix, planes);
+
+        for(int t=0; t<triangleCount; t++) {
+            int slots[3] = {3*t, 3*t + 1, 3*t + 2};
+            appendFusedTriangle(blocks, slots, worldTriangles[first + t].rgb, worldTriangles[first + t].id, config, bClipping, triangles, counters);
+        }
+    }
+}
+
+/*
+    frame buffer: one aligned allocation holding a depth plane (double, float32 or 24-bit unorm)
+    followed by an RGBA8 color plane; rows of both planes start on FRAME_BUFFER_ALIGNMENT boundaries
+*/
+
+#define FRAME_BUFFER_ALIGNMENT 64
+#define UNORM24_MAX 16777215u
+
+/*
+    hierarchical z: maximum (farthest) encoded depth of every HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE block of
+    depth plane, refreshed lazily after writes; HIZ_DEPTH_EPSILON absorbs rounding of interpolated z values
+*/
+#define HIZ_BLOCK_SIZE 8
+#define HIZ_DEPTH_EPSILON 1e-9
+
+/* color plane value of pixels covered by no triangle in visibility buffer mode */
+#define VISIBILITY_NONE 0xffffffffu
+
+/* stage 4 counters; kernels count into a local copy & add it to frame buffer's counters (if any) once per triangle */
+struct RasterCounters {
+    uint64_t trianglesSubmitted;
+    uint64_t trianglesCulledBack;
+    uint64_t trianglesCulledFront;
+    uint64_t trianglesCulledDegenerate;
+    uint64_t trianglesCulledSmall;
+    uint64_t trianglesOccluded;
+    uint64_t scanlines;
+    uint64_t segmentsOccluded;
+    uint64_t pixelsTested;
+    uint64_t pixelsWritten;
+
+    RasterCounters() {
+        trianglesSubmitted = trianglesOccluded = scanlines = segmentsOccluded = pixelsTested = pixelsWritten = 0;
+        trianglesCulledBack = trianglesCulledFront = trianglesCulledDegenerate = trianglesCulledSmall = 0;
+    }
+
+    void add(const RasterCounters& counters) {
+        trianglesSubmitted += counters.trianglesSubmitted;
+        trianglesCulledBack += counters.trianglesCulledBack;
+        trianglesCulledFront += counters.trianglesCulledFront;
+        trianglesCulledDegenerate += counters.trianglesCulledDegenerate;
+        trianglesCulledSmall += counters.trianglesCulledSmall;
+        trianglesOccluded += counters.trianglesOccluded;
+        scanlines += counters.scanlines;
+        segmentsOccluded += counters.segmentsOccluded;
+        pixelsTested += counters.pixelsTested;
+        pixelsWritten += counters.pixelsWritten;
+    }
+};
+
+inline int countSetBits(int bits) {
+    int count = 0;
+    for(; bits!=0; bits&=bits-1) {
+        count++;
+    }
+    return count;
+}
+
+inline uint32_t packColor(Color color) {
+    return (uint32_t) color.redValue | ((uint32_t) color.greenValue<<8) | ((uint32_t) color.blueValue<<16) | (255u<<24);
+}
+
+inline Color unpackColor(uint32_t packedColor) {
+    Color color = {(int) (packedColor & 255u), (int) ((packedColor>>8) & 255u), (int) ((packedColor>>16) & 255u)};
+    return color;
+}
+
+/* depth formats; encode() is monotonic, so depth test is carried out on encoded values */
+struct DoubleDepth {
+    typedef double Value;
+
+    static Value encode(double z, Config&) {
+        return z;
+    }
+
+    static double decode(Value value, Config&) {
+        return value;
+    }
+};
+
+struct Float32Depth {
+    typedef float Value;
+
+    static Value encode(double z, Config&) {
+        return (float) z;
+    }
+
+    static double decode(Value value, Config&) {
+        return value;
+    }
+};
+
+struct Unorm24Depth {
+    typedef uint32_t Value;
+
+    static Value encode(double z, Config& config) {
+        /* mapping [frontLimitZ, rearLimitZ] onto [0, 2^24 - 1] */
+        double t = (z - config.frontLimitZ)/(config.rearLimitZ - config.frontLimitZ);
+        t = min(1.0, max(0.0, t));
+        return (uint32_t) (t*UNORM24_MAX + 0.5);
+    }
+
+    static double decode(Value value, Config& config) {
+        return config.frontLimitZ + (config.rearLimitZ - config.frontLimitZ)*(value/(double) UNORM24_MAX);
+    }
+};
+
+/*
+    with multisampling, every pixel holds sampleCount consecutive depth & color samples; resolve() reduces
+    buffer in place to one sample per pixel before outputs are written
+*/
+class FrameBuffer {
+    int width;
+    int height;
+    int depthFormat;
+    int sampleCount;
+
+    size_t depthPitch;
+    size_t colorPitch;
+    size_t capacity;
+
+    unsigned char* storage;
+    unsigned char* depthPlane;
+    unsigned char* colorPlane;
+
+    bool bHierarchicalZ;
+    int blockColumns;
+    int blockRows;
+    vector<double> blockMaxDepth;
+    vector<unsigned char> blockDirty;
+
+    RasterCounters* counters;
+
+    static size_t alignUp(size_t size) {
+        return (size + FRAME_BUFFER_ALIGNMENT - 1)/FRAME_BUFFER_ALIGNMENT*FRAME_BUFFER_ALIGNMENT;
+    }
+
+    template<class Value>
+    static void resolveDepthRow(Value* depthRow, int width, int sampleCount) {
+        /* keeping nearest sample; pixel c is written only after its samples (at c*sampleCount onwards) are read */
+        for(int column=0; column<width; column++) {
+            Value depth = depthRow[column*sampleCount];
+
+            for(int sample=1; sample<sampleCount; sample++) {
+                depth = min(depth, depthRow[column*sampleCount + sample]);
+            }
+            depthRow[column] = depth;
+        }
+    }
+
+public:
+    FrameBuffer() {
+        width = height = 0;
+        depthFormat = DEPTH_FORMAT_DOUBLE;
+        sampleCount = 1;
+        depthPitch = colorPitch = capacity = 0;
+        storage = depthPlane = colorPlane = NULL;
+        bHierarchicalZ = false;
+        blockColumns = blockRows = 0;
+        counters = NULL;
+    }
+
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    static size_t getDepthSize(int depthFormat) {
+        return (depthFormat == DEPTH_FORMAT_DOUBLE)? sizeof(double): sizeof(uint32_t);
+    }
+
+    void allocate(int width, int height, int depthFormat, int sampleCount);
+    void clear(Config& config);
+    void fillColor(uint32_t packedColor);
+    void copyRegion(FrameBuffer& source, int firstRow, int firstColumn);
+    void resolve();
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    int getDepthFormat() const {
+        return depthFormat;
+    }
+
+    int getSampleCount() const {
+        return sampleCount;
+    }
+
+    template<class Depth>
+    typename Depth::Value* getDepthRow(int row) {
+        return (typename Depth::Value*) (depthPlane + row*depthPitch);
+    }
+
+    uint32_t* getColorRow(int row) {
+        return (uint32_t*) (colorPlane + row*colorPitch);
+    }
+
+    bool isDepthWritten(int row, int column, Config& config);
+    double getDepth(int row, int column, Config& config);
+
+    void setHierarchicalZ(bool bHierarchicalZ) {
+        this->bHierarchicalZ = bHierarchicalZ;
+    }
+
+    bool hasHierarchicalZ() const {
+        return bHierarchicalZ;
+    }
+
+    void markBlocksDirty(int firstRow, int lastRow, int firstColumn, int lastColumn);
+
+    /* counters are collected only while set (NULL by default) */
+    void setCounters(RasterCounters* counters) {
+        this->counters = counters;
+    }
+
+    RasterCounters* getCounters() {
+        return counters;
+    }
+
+    void addCounters(const RasterCounters& counts) {
+        if(counters != NULL) {
+            counters->add(counts);
+        }
+    }
+
+    template<class Depth>
+    double getBlockMaxDepth(int blockRow, int blockColumn) {
+        int block = blockRow*blockColumns + blockColumn;
+
+        if(blockDirty[block]) {
+            int lastRow = min(height, (blockRow + 1)*HIZ_BLOCK_SIZE);
+            int lastColumn = min(width, (blockColumn + 1)*HIZ_BLOCK_SIZE);
+            typename Depth::Value maxDepth = getDepthRow<Depth>(blockRow*HIZ_BLOCK_SIZE)[blockColumn*HIZ_BLOCK_SIZE*sampleCount];
+
+            for(int row=blockRow*HIZ_BLOCK_SIZE; row<lastRow; row++) {
+                typename Depth::Value* depthRow = getDepthRow<Depth>(row);
+
+                for(int sample=blockColumn*HIZ_BLOCK_SIZE*sampleCount; sample<lastColumn*sampleCount; sample++) {
+                    maxDepth = max(maxDepth, depthRow[sample]);
+                }
+            }
+            blockMaxDepth[block] = (double) maxDepth;
+            blockDirty[block] = 0;
+        }
+        return blockMaxDepth[block];
+    }
+
+    template<class Depth>
+    bool isRegionOccluded(int firstRow, int lastRow, int firstColumn, int lastColumn, double nearestDepth, Config& config) {
+        /* true when nearestDepth fails depth test against every pixel of region (given in pixels of this buffer) */
+        double nearestEncodedDepth = (double) Depth::encode(nearestDepth - HIZ_DEPTH_EPSILON*(1.0 + fabs(nearestDepth)), config);
+
+        for(int blockRow=firstRow/HIZ_BLOCK_SIZE; blockRow<=lastRow/HIZ_BLOCK_SIZE; blockRow++) {
+            for(int blockColumn=firstColumn/HIZ_BLOCK_SIZE; blockColumn<=lastColumn/HIZ_BLOCK_SIZE; blockColumn++) {
+                if(nearestEncodedDepth < getBlockMaxDepth<Depth>(blockRow, blockColumn)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    ~FrameBuffer() {
+        delete[] storage;
+    }
+};
+
+void FrameBuffer::allocate(int width, int height, int depthFormat, int sampleCount) {
+    /* storage is kept when it is large enough, so buffers can be reused across frames */
+    size_t newDepthPitch = alignUp(width*sampleCount*getDepthSize(depthFormat));
+    size_t newColorPitch = alignUp(width*sampleCount*sizeof(uint32_t));
+    size_t required = (newDepthPitch + newColorPitch)*height + FRAME_BUFFER_ALIGNMENT;
+
+    if(required > capacity) {
+        delete[] storage;
+        storage = new unsigned char[required];
+        capacity = required;
+    }
+
+    this->width = width;
+    this->height = height;
+    this->depthFormat = depthFormat;
+    this->sampleCount = sampleCount;
+
+    depthPitch = newDepthPitch;
+    colorPitch = newColorPitch;
+    depthPlane = storage + (FRAME_BUFFER_ALIGNMENT - ((uintptr_t) storage)%FRAME_BUFFER_ALIGNMENT)%FRAME_BUFFER_ALIGNMENT;
+    colorPlane = depthPlane + depthPitch*height;
+
+    blockColumns = (width + HIZ_BLOCK_SIZE - 1)/HIZ_BLOCK_SIZE;
+    blockRows = (height + HIZ_BLOCK_SIZE - 1)/HIZ_BLOCK_SIZE;
+    blockMaxDepth.resize(blockColumns*blockRows);
+    blockDirty.resize(blockColumns*blockRows);
+}
+
+void FrameBuffer::markBlocksDirty(int firstRow, int lastRow, int firstColumn, int lastColumn) {
+    for(int blockRow=firstRow/HIZ_BLOCK_SIZE; blockRow<=lastRow/HIZ_BLOCK_SIZE; blockRow++) {
+        for(int blockColumn=firstColumn/HIZ_BLOCK_SIZE; blockColumn<=lastColumn/HIZ_BLOCK_SIZE; blockColumn++) {
+            blockDirty[blockRow*blockColumns + blockColumn] = 1;
+        }
+    }
+}
+
+void FrameBuffer::clear(Config& config) {
+    /* clearing depth plane to rearLimitZ & color plane to black */
+    uint32_t black = packColor(Color{0, 0, 0});
+    int rowSamples = width*sampleCount;
+
+    for(int row=0; row<height; row++) {
+        if(depthFormat == DEPTH_FORMAT_DOUBLE) {
+            fill(getDepthRow<DoubleDepth>(row), getDepthRow<DoubleDepth>(row)+rowSamples, DoubleDepth::encode(config.rearLimitZ, config));
+        } else if(depthFormat == DEPTH_FORMAT_FLOAT32) {
+            fill(getDepthRow<Float32Depth>(row), getDepthRow<Float32Depth>(row)+rowSamples, Float32Depth::encode(config.rearLimitZ, config));
+        } else {
+            fill(getDepthRow<Unorm24Depth>(row), getDepthRow<Unorm24Depth>(row)+rowSamples, Unorm24Depth::encode(config.rearLimitZ, config));
+        }
+        fill(getColorRow(row), getColorRow(row)+rowSamples, black);
+    }
+
+    /* every block now holds encoded rearLimitZ only */
+    fill(blockDirty.begin(), blockDirty.end(), 1);
+}
+
+void FrameBuffer::fillColor(uint32_t packedColor) {
+    for(int row=0; row<height; row++) {
+        fill(getColorRow(row), getColorRow(row)+width*sampleCount, packedColor);
+    }
+}
+
+void FrameBuffer::copyRegion(FrameBuffer& source, int firstRow, int firstColumn) {
+    /* copying source (of same depth format & sample count) into this buffer with its top left pixel at (firstRow, firstColumn) */
+    int rowCount = min(source.height, height - firstRow);
+    int columnCount = min(source.width, width - firstColumn);
+    size_t depthSize = getDepthSize(depthFormat);
+
+    for(int row=0; row<rowCount; row++) {
+        memcpy(depthPlane + (firstRow + row)*depthPitch + firstColumn*sampleCount*depthSize, source.depthPlane + row*source.depthPitch, columnCount*sampleCount*depthSize);
+        memcpy(getColorRow(firstRow + row) + firstColumn*sampleCount, source.getColorRow(row), columnCount*sampleCount*sizeof(uint32_t));
+    }
+
+    if(rowCount>0 && columnCount>0) {
+        markBlocksDirty(firstRow, firstRow + rowCount - 1, firstColumn, firstColumn + columnCount - 1);
+    }
+}
+
+void FrameBuffer::resolve() {
+    /* averaging colors & keeping nearest depth of samples of every pixel; rows keep their pitch */
+    if(sampleCount == 1) {
+        return;
+    }
+
+    for(int row=0; row<height; row++) {
+        if(depthFormat == DEPTH_FORMAT_DOUBLE) {
+            resolveDepthRow(getDepthRow<DoubleDepth>(row), width, sampleCount);
+        } else if(depthFormat == DEPTH_FORMAT_FLOAT32) {
+            resolveDepthRow(getDepthRow<Float32Depth>(row), width, sampleCount);
+        } else {
+            resolveDepthRow(getDepthRow<Unorm24Depth>(row), width, sampleCount);
+        }
+
+        uint32_t* colorRow = getColorRow(row);
+
+        for(int column=0; column<width; column++) {
+            uint32_t red = 0, green = 0, blue = 0;
+
+            for(int sample=0; sample<sampleCount; sample++) {
+                uint32_t packedColor = colorRow[column*sampleCount + sample];
+
+                red += packedColor & 255u;
+                green += (packedColor>>8) & 255u;
+                blue += (packedColor>>16) & 255u;
+            }
+
+            Color color = {(int) ((red + sampleCount/2)/sampleCount), (int) ((green + sampleCount/2)/sampleCount), (int) ((blue + sampleCount/2)/sampleCount)};
+            colorRow[column] = packColor(color);
+        }
+    }
+
+    sampleCount = 1;
+    fill(blockDirty.begin(), blockDirty.end(), 1);
+}
+
+bool FrameBuffer::isDepthWritten(int row, int column, Config& config) {
+    if(depthFormat == DEPTH_FORMAT_DOUBLE) {
+        return getDepthRow<DoubleDepth>(row)[column] < DoubleDepth::encode(config.rearLimitZ, config);
+    } else if(depthFormat == DEPTH_FORMAT_FLOAT32) {
+        return getDepthRow<Float32Depth>(row)[column] < Float32Depth::encode(config.rearLimitZ, config);
+    }
+    return getDepthRow<Unorm24Depth>(row)[column] < Unorm24Depth::encode(config.rearLimitZ, config);
+}
+
+double FrameBuffer::getDepth(int row, int column, Config& config) {
+    if(depthFormat == DEPTH_FORMAT_DOUBLE) {
+        return DoubleDepth::decode(getDepthRow<DoubleDepth>(row)[column], config);
+    } else if(depthFormat == DEPTH_FORMAT_FLOAT32) {
+        return Float32Depth::decode(getDepthRow<Float32Depth>(row)[column], config);
+    }
+    return Unorm24Depth::decode(getDepthRow<Unorm24Depth>(row)[column], config);
+}
+
+void findScanlines(Triangle& triangle, Config& config, int& topScanline, int& bottomScanline) {
+    /* finding topScanline & bottomScanline after necessary clipping */
+    double maxY = max(triangle.corners[0].getY(), max(triangle.corners[1].getY(), triangle.corners[2].getY()));
+    double minY = min(triangle.corners[0].getY(), min(triangle.corners[1].getY(), triangle.corners[2].getY()));
+
+    if(maxY >= config.topY) {
+        topScanline = 0;
+    } else {
+        topScanline = (int) round((config.topY - maxY)/config.dy);
+    }
+    if(minY <= config.bottomY) {
+        bottomScanline = config.screenHeight - 1;
+    } else {
+        bottomScanline = config.screenHeight - (1 + ((int) round((minY - config.bottomY)/config.dy)));
+    }
+}
+
+void findColumns(Triangle& triangle, Config& config, int& leftColumn, int& rightColumn) {
+    /* bounding columns of triangle; every span found by scanTriangle() lies within them */
+    double maxX = max(triangle.corners[0].getX(), max(triangle.corners[1].getX(), triangle.corners[2].getX()));
+    double minX = min(triangle.corners[0].getX(), min(triangle.corners[1].getX(), triangle.corners[2].getX()));
+
+    if(minX <= config.leftX) {
+        leftColumn = 0;
+    } else {
+        leftColumn = (int) round((minX - config.leftX)/config.dx);
+    }
+    if(maxX >= config.rightX) {
+        rightColumn = config.screenWidth - 1;
+    } else {
+        rightColumn = config.screenWidth - (1 + ((int) round((config.rightX - maxX)/config.dx)));
+    }
+}
+
+template<class Depth>
+void scanTriangle(Triangle& triangle, uint32_t packedColor, Config& config, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& target) {
+    /*
+        scan converting triangle restricted to rows [firstRow, lastRow] & columns [firstColumn, lastColumn]
+        target's pixel (0, 0) corresponds to screen pixel (firstRow, firstColumn)
+    */
+    RasterCounters counts;
+
+    double dx = config.dx, dy = config.dy, topY = config.topY, leftX = config.leftX, rightX = config.rightX;
+    int topScanline, bottomScanline;
+
+    findScanlines(triangle, config, topScanline, bottomScanline);
+
+    topScanline = max(topScanline, firstRow);
+    bottomScanline = min(bottomScanline, lastRow);
+
+    /* scanning from topScanline to bottomScanline (inclusive) */
+    for(int row=topScanline, leftIntersectingColumn, rightIntersectingColumn; row<=bottomScanline; row++) {
+        /* defining three intersecting points on triangle's three sides */
+        double ys = topY - row*dy;
+
+        Point intersectingPoints[3];
+        intersectingPoints[0] = Point(INF, ys, 0, 1);
+        intersectingPoints[1] = Point(INF, ys, 1, 2);
+        intersectingPoints[2] = Point(INF, ys, 2, 0);
+
+        /* determining intersecting points' x value (if any) */
+        for(int j=0; j<3; j++) {
+            Point p1 = triangle.corners[(int) intersectingPoints[j].getZ()];
+            Point p2 = triangle.corners[(int) intersectingPoints[j].getW()];
+
+            if(p1.getY() != p2.getY()) {
+                intersectingPoints[j].setX(p1.getX() + (ys - p1.getY())*(p1.getX() - p2.getX())/(p1.getY() - p2.getY()));
+            }
+        }
+
+        /* filtering out all invalid points (if any) */
+        for(int j=0; j<3; j++) {
+            Point p1 = triangle.corners[(int) intersectingPoints[j].getZ()];
+            Point p2 = triangle.corners[(int) intersectingPoints[j].getW()];
+
+            if(intersectingPoints[j].getX() != INF) {
+                if(intersectingPoints[j].getX()>max(p1.getX(), p2.getX()) || intersectingPoints[j].getX()<min(p1.getX(), p2.getX()) || intersectingPoints[j].getY()>max(p1.getY(), p2.getY()) || intersectingPoints[j].getY()<min(p1.getY(), p2.getY())) {
+                    intersectingPoints[j].setX(INF);
+                }
+            }
+        }
+
+        /* finding out leftIntersecting & rightIntersecting points */
+        int maxIndex, minIndex;
+        maxIndex = minIndex = -1;
+
+        double maxX = 0.0, minX = 0.0;
+
+        for(int j=0; j<3; j++) {
+            if(maxIndex==-1 && minIndex==-1) {
+                if(intersectingPoints[j].getX() != INF) {
+                    maxIndex = minIndex = j;
+                    maxX = minX = intersectingPoints[j].getX();
+                }
+            } else {
+                if(intersectingPoints[j].getX() != INF) {
+                    if(intersectingPoints[j].getX() < minX) {
+                        minIndex = j;
+                        minX = intersectingPoints[j].getX();
+                    }
+                    if(intersectingPoints[j].getX() > maxX) {
+                        maxIndex = j;
+                        maxX = intersectingPoints[j].getX();
+                    }
+                }
+            }
+        }
+
+        /* row may cross no edge at all (e.g. bounding rows of a flat or degenerate triangle) */
+        if(minIndex == -1) {
+            continue;
+        }
+
+        /* finding leftIntersectingColumn & rightIntersectingColumn after necessary clipping */
+        if(intersectingPoints[minIndex].getX() <= leftX) {
+            leftIntersectingColumn = 0;
+        } else {
+            leftIntersectingColumn = (int) round((intersectingPoints[minIndex].getX() - leftX)/dx);
+        }
+        if(intersectingPoints[maxIndex].getX() >= rightX) {
+            rightIntersectingColumn = config.screenWidth - 1;
+        } else {
+            rightIntersectingColumn = config.screenWidth - (1 + ((int) round((rightX - intersectingPoints[maxIndex].getX())/dx)));
+        }
+
+        /* determining za & zb values */
+        Point p1 = triangle.corners[(int) intersectingPoints[minIndex].getZ()];
+        Point p2 = triangle.corners[(int) intersectingPoints[minIndex].getW()];
+
+        double za = p1.getZ() + (intersectingPoints[minIndex].getY() - p1.getY())*(p2.getZ() - p1.getZ())/(p2.getY() - p1.getY());
+
+        p1 = triangle.corners[(int) intersectingPoints[maxIndex].getZ()];
+        p2 = triangle.corners[(int) intersectingPoints[maxIndex].getW()];
+
+        double zb = p1.getZ() + (intersectingPoints[maxIndex].getY() - p1.getY())*(p2.getZ() - p1.getZ())/(p2.getY() - p1.getY());
+
+        /*
+            scanning from leftIntersectingColumn to rightIntersectingColumn (inclusive)
+            z value is evaluated per column (not accumulated), so a span clipped to a tile yields the same bits as the full span
+        */
+        double xa = intersectingPoints[minIndex].getX();
+        double xb = intersectingPoints[maxIndex].getX();
+
+        typename Depth::Value* zBufferRow = target.getDepthRow<Depth>(row - firstRow) - firstColumn;
+        uint32_t* frameBufferRow = target.getColorRow(row - firstRow) - firstColumn;
+
+        leftIntersectingColumn = max(leftIntersectingColumn, firstColumn);
+        rightIntersectingColumn = min(rightIntersectingColumn, lastColumn);
+
+        counts.scanlines++;
+
+        /* span is split at hierarchical z block boundaries (if enabled) & occluded segments are skipped */
+        int segmentWidth = target.hasHierarchicalZ()? HIZ_BLOCK_SIZE: lastColumn - firstColumn + 1;
+
+        for(int segmentStart=leftIntersectingColumn, segmentEnd; segmentStart<=rightIntersectingColumn; segmentStart=segmentEnd+1) {
+            segmentEnd = min(rightIntersectingColumn, firstColumn + ((segmentStart - firstColumn)/segmentWidth + 1)*segmentWidth - 1);
+
+            if(target.hasHierarchicalZ()) {
+                double zStart = za + ((leftX + segmentStart*dx) - xa)*(zb - za)/(xb - xa);
+                double zEnd = za + ((leftX + segmentEnd*dx) - xa)*(zb - za)/(xb - xa);
+
+                if(target.isRegionOccluded<Depth>(row - firstRow, row - firstRow, segmentStart - firstColumn, segmentEnd - firstColumn, min(zStart, zEnd), config)) {
+                    counts.segmentsOccluded++;
+                    continue;
+                }
+            }
+
+            counts.pixelsTested += segmentEnd - segmentStart + 1;
+
+            for(int column=segmentStart; column<=segmentEnd; column++) {
+                /* calculating z value */
+                double zp = za + ((leftX + column*dx) - xa)*(zb - za)/(xb - xa);
+
+                /* comparing computed z value with current value in zBuffer[row][column] & frontLimitZ and updating zBuffer[row][column] & frameBuffer[row][column] if necessary */
+                typename Depth::Value depth = Depth::encode(zp, config);
+
+                if(zp>config.frontLimitZ && depth<zBufferRow[column]) {
+                    zBufferRow[column] = depth;
+                    frameBufferRow[column] = packedColor;
+                    counts.pixelsWritten++;
+                }
+            }
+        }
+    }
+
+    target.addCounters(counts);
+}
+
+/*
+    half-space rasterizer: edge equations & depth plane are set up once per triangle in screen space,
+    where center of pixel (row, column) lies at (column, row); pixels are then tested & depth-interpolated
+    4 (SSE2) or 8 (AVX) at a time, following top-left fill rule
+*/
+
+struct HalfSpaceSetup {
+    double edgeA[3], edgeB[3], edgeC[3];
+    bool bTopLeft[3];
+    double depthA, depthB, depthC;
+    int firstRow, lastRow, firstColumn, lastColumn;
+};
+
+bool setUpHalfSpace(Triangle& triangle, Config& config, int firstRow, int lastRow, int firstColumn, int lastColumn, double margin, HalfSpaceSetup& setup) {
+    double x[3], y[3], z[3];
+
+    for(int j=0; j<3; j++) {
+        x[j] = (triangle.corners[j].getX() - config.leftX)/config.dx;
+        y[j] = (config.topY - triangle.corners[j].getY())/config.dy;
+        z[j] = triangle.corners[j].getZ();
+    }
+
+    double area = (x[1] - x[0])*(y[2] - y[0]) - (y[1] - y[0])*(x[2] - x[0]);
+    if(area==0.0 || !isfinite(area)) {
+        return false;
+    }
+    if(area < 0.0) {
+        swap(x[1], x[2]);
+        swap(y[1], y[2]);
+        swap(z[1], z[2]);
+        area = -area;
+    }
+
+    /* edge j runs from corner j to corner j+1; interior has positive edge values */
+    for(int j=0; j<3; j++) {
+        int k = (j + 1)%3;
+
+        setup.edgeA[j] = y[j] - y[k];
+        setup.edgeB[j] = x[k] - x[j];
+        setup.edgeC[j] = -(setup.edgeA[j]*x[j] + setup.edgeB[j]*y[j]);
+        setup.bTopLeft[j] = setup.edgeA[j]>0.0 || (setup.edgeA[j]==0.0 && setup.edgeB[j]>0.0);
+    }
+
+    /* edge j is opposite to corner j+2, so it weights that corner's z value */
+    setup.depthA = (setup.edgeA[1]*z[0] + setup.edgeA[2]*z[1] + setup.edgeA[0]*z[2])/area;
+    setup.depthB = (setup.edgeB[1]*z[0] + setup.edgeB[2]*z[1] + setup.edgeB[0]*z[2])/area;
+    setup.depthC = (setup.edgeC[1]*z[0] + setup.edgeC[2]*z[1] + setup.edgeC[0]*z[2])/area;
+
+    /* bounding box of pixels whose centers (or samples, lying within margin of centers) may be covered, clipped to target region */
+    double minX = min(x[0], min(x[1], x[2])) - margin, maxX = max(x[0], max(x[1], x[2])) + margin;
+    double minY = min(y[0], min(y[1], y[2])) - margin, maxY = max(y[0], max(y[1], y[2])) + margin;
+
+    setup.firstColumn = (int) max((double) firstColumn, ceil(minX));
+    setup.lastColumn = (int) min((double) lastColumn, floor(maxX));
+    setup.firstRow = (int) max((double) firstRow, ceil(minY));
+    setup.lastRow = (int) min((double) lastRow, floor(maxY));
+
+    return setup.firstColumn<=setup.lastColumn && setup.firstRow<=setup.lastRow;
+}
+
+inline bool isInsideEdge(double edgeValue, bool bTopLeft) {
+    return edgeValue>0.0 || (edgeValue==0.0 && bTopLeft);
+}
+
+template<class Depth>
+inline void shadeHalfSpacePixel(HalfSpaceSetup& setup, uint32_t packedColor, Config& config, int row, int column, typename Depth::Value* zBufferRow, uint32_t* frameBufferRow, RasterCounters& counts) {
+    for(int j=0; j<3; j++) {
+        if(!isInsideEdge(setup.edgeA[j]*column + setup.edgeB[j]*row + setup.edgeC[j], setup.bTopLeft[j])) {
+            return;
+        }
+    }
+    counts.pixelsTested++;
+
+    double zp = setup.depthA*column + setup.depthB*row + setup.depthC;
+    typename Depth::Value depth = Depth::encode(zp, config);
+
+    if(zp>config.frontLimitZ && depth<zBufferRow[column]) {
+        zBufferRow[column] = depth;
+        frameBufferRow[column] = packedColor;
+        counts.pixelsWritten++;
+    }
+}
+
+
+#if defined(__AVX__) || defined(__SSE2__)
+/* depth testing one vector of lanes already known to be covered & in front of frontLimitZ; returns mask of written lanes */
+template<class Depth>
+struct HalfSpaceDepthTest {
+    static int apply(DoubleLanes::Vector zp, DoubleLanes::Vector mask, typename Depth::Value* zBufferRow, Config& config) {
+        double values[DoubleLanes::width];
+        DoubleLanes::storeLanes(values, zp);
+
+        int bits = DoubleLanes::moveMask(mask);
+
+        int writtenBits = 0;
+        for(int lane=0; lane<DoubleLanes::width; lane++) {
+            if(bits & (1<<lane)) {
+                typename Depth::Value depth = Depth::encode(values[lane], config);
+
+                if(depth < zBufferRow[lane]) {
+                    zBufferRow[lane] = depth;
+                    writtenBits |= 1<<lane;
+                }
+            }
+        }
+        return writtenBits;
+    }
+};
+
+template<>
+struct HalfSpaceDepthTest<DoubleDepth> {
+    static int apply(DoubleLanes::Vector zp, DoubleLanes::Vector mask, double* zBufferRow, Config&) {
+        DoubleLanes::Vector zOld = DoubleLanes::load(zBufferRow);
+        mask = DoubleLanes::bitAnd(mask, DoubleLanes::less(zp, zOld));
+
+        int writtenBits = DoubleLanes::moveMask(mask);
+        if(writtenBits != 0) {
+            DoubleLanes::store(zBufferRow, DoubleLanes::select(mask, zp, zOld));
+        }
+        return writtenBits;
+    }
+};
+#endif
+
+template<class Depth>
+void rasterizeHalfSpace(Triangle& triangle, uint32_t packedColor, Config& config, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& target) {
+    /* target's pixel (0, 0) corresponds to screen pixel (firstRow, firstColumn), as in scanTriangle() */
+    HalfSpaceSetup setup;
+    RasterCounters counts;
+
+    if(!setUpHalfSpace(triangle, config, firstRow, lastRow, firstColumn, lastColumn, 0.0, setup)) {
+        return;
+    }
+
+#if defined(__AVX__) || defined(__SSE2__)
+    typedef DoubleLanes Lanes;
+    typedef Lanes::Vector Vector;
+
+    const int groupWidth = 2*Lanes::width;
+
+    Vector zero = Lanes::broadcast(0.0);
+    Vector allSet = Lanes::equal(zero, zero);
+    Vector frontLimit = Lanes::broadcast(config.frontLimitZ);
+    Vector laneOffsets = Lanes::laneOffsets();
+    Vector edgeA[3], topLeftMask[3];
+
+    for(int j=0; j<3; j++) {
+        edgeA[j] = Lanes::broadcast(setup.edgeA[j]);
+        topLeftMask[j] = setup.bTopLeft[j]? allSet: zero;
+    }
+    Vector depthA = Lanes::broadcast(setup.depthA);
+#endif
+
+    for(int row=setup.firstRow; row<=setup.lastRow; row++) {
+        typename Depth::Value* zBufferRow = target.getDepthRow<Depth>(row - firstRow) - firstColumn;
+        uint32_t* frameBufferRow = target.getColorRow(row - firstRow) - firstColumn;
+        int column = setup.firstColumn;
+
+        counts.scanlines++;
+
+#if defined(__AVX__) || defined(__SSE2__)
+        Vector edgeRow[3];
+        for(int j=0; j<3; j++) {
+            edgeRow[j] = Lanes::broadcast(setup.edgeB[j]*row + setup.edgeC[j]);
+        }
+        Vector depthRow = Lanes::broadcast(setup.depthB*row + setup.depthC);
+
+        for(; column+groupWidth-1<=setup.lastColumn; column+=groupWidth) {
+            for(int half=0; half<2; half++) {
+                int baseColumn = column + half*Lanes::width;
+                Vector columns = Lanes::add(Lanes::broadcast((double) baseColumn), laneOffsets);
+
+                Vector mask = allSet;
+                for(int j=0; j<3; j++) {
+                    Vector edgeValue = Lanes::add(Lanes::multiply(edgeA[j], columns), edgeRow[j]);
+                    mask = Lanes::bitAnd(mask, Lanes::bitOr(Lanes::greater(edgeValue, zero), Lanes::bitAnd(Lanes::equal(edgeValue, zero), topLeftMask[j])));
+                }
+                int coveredBits = Lanes::moveMask(mask);
+                if(coveredBits == 0) {
+                    continue;
+                }
+                counts.pixelsTested += countSetBits(coveredBits);
+
+                Vector zp = Lanes::add(Lanes::multiply(depthA, columns), depthRow);
+
+                mask = Lanes::bitAnd(mask, Lanes::greater(zp, frontLimit));
+                if(Lanes::moveMask(mask) == 0) {
+                    continue;
+                }
+
+                int bits = HalfSpaceDepthTest<Depth>::apply(zp, mask, zBufferRow + baseColumn, config);
+                counts.pixelsWritten += countSetBits(bits);
+
+                for(int lane=0; lane<Lanes::width; lane++) {
+                    if(bits & (1<<lane)) {
+                        frameBufferRow[baseColumn + lane] = packedColor;
+                    }
+                }
+            }
+        }
+#endif
+
+        for(; column<=setup.lastColumn; column++) {
+            shadeHalfSpacePixel<Depth>(setup, packedColor, config, row, column, zBufferRow, frameBufferRow, counts);
+        }
+    }
+
+    target.addCounters(counts);
+}
+
+/*
+    fixed-point rasterizer: corners are snapped to a grid of 2^subpixelBits steps per pixel & edge functions
+    are evaluated exactly in 64-bit integers at pixel centers; pixels on an edge belong to the triangle only
+    if it is a top or left edge, so triangles sharing an edge cover each pixel along it exactly once
+*/
+
+#define FIXED_POINT_COORDINATE_LIMIT (1LL<<29)  // keeps edge function values well inside int64
+
+struct FixedPointSetup {
+    int64_t edgeA[3], edgeB[3];
+    int64_t edgeRow[3];  // edge values (biased by fill rule) at column 0 of current row
+    double depthA, depthB, depthC;
+    int firstRow, lastRow, firstColumn, lastColumn;
+};
+
+bool isFixedPointRepresentable(Triangle& triangle, Config& config, int subpixelBits) {
+    /* corners far outside screen (possible without clipping) are left to floating point edge equations */
+    double scale = (double) (1LL<<subpixelBits);
+
+    for(int j=0; j<3; j++) {
+        double fixedX = (triangle.corners[j].getX() - config.leftX)/config.dx*scale;
+        double fixedY = (config.topY - triangle.corners[j].getY())/config.dy*scale;
+
+        if(!(fabs(fixedX) < FIXED_POINT_COORDINATE_LIMIT) || !(fabs(fixedY) < FIXED_POINT_COORDINATE_LIMIT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool setUpFixedPoint(Triangle& triangle, Config& config, int subpixelBits, int firstRow, int lastRow, int firstColumn, int lastColumn, FixedPointSetup& setup) {
+    double scale = (double) (1LL<<subpixelBits);
+    int64_t x[3], y[3];
+    double z[3];
+
+    for(int j=0; j<3; j++) {
+        x[j] = llround((triangle.corners[j].getX() - config.leftX)/config.dx*scale);
+        y[j] = llround((config.topY - triangle.corners[j].getY())/config.dy*scale);
+        z[j] = triangle.corners[j].getZ();
+    }
+
+    int64_t area = (x[1] - x[0])*(y[2] - y[0]) - (y[1] - y[0])*(x[2] - x[0]);
+    if(area < 0) {
+        swap(x[1], x[2]);
+        swap(y[1], y[2]);
+        swap(z[1], z[2]);
+        area = -area;
+    }
+
+    /* bounding box of covered pixel centers (multiples of 2^subpixelBits), clipped to target region */
+    setup.firstColumn = max(firstColumn, (int) -((-min(x[0], min(x[1], x[2])))>>subpixelBits));
+    setup.lastColumn = min(lastColumn, (int) (max(x[0], max(x[1], x[2]))>>subpixelBits));
+    setup.firstRow = max(firstRow, (int) -((-min(y[0], min(y[1], y[2])))>>subpixelBits));
+    setup.lastRow = min(lastRow, (int) (max(y[0], max(y[1], y[2]))>>subpixelBits));
+
+    if(area==0 || setup.firstColumn>setup.lastColumn || setup.firstRow>setup.lastRow) {
+        return false;
+    }
+
+    /* edge j runs from corner j to corner j+1 as in setUpHalfSpace(); non top-left edges are biased by -1, so that inside means >= 0 */
+    for(int j=0; j<3; j++) {
+        int k = (j + 1)%3;
+        int64_t edgeA = y[j] - y[k];
+        int64_t edgeB = x[k] - x[j];
+        bool bTopLeft = edgeA>0 || (edgeA==0 && edgeB>0);
+
+        setup.edgeA[j] = edgeA*((int64_t) 1<<subpixelBits);
+        setup.edgeB[j] = edgeB*((int64_t) 1<<subpixelBits);
+        setup.edgeRow[j] = -(edgeA*x[j] + edgeB*y[j]) - (bTopLeft? 0: 1) + setup.edgeB[j]*setup.firstRow;
+    }
+
+    /* depth plane of snapped corners per pixel, taken relative to corner 0 */
+    double dx1 = (double) (x[1] - x[0]), dy1 = (double) (y[1] - y[0]);
+    double dx2 = (double) (x[2] - x[0]), dy2 = (double) (y[2] - y[0]);
+
+    setup.depthA = ((z[1] - z[0])*dy2 - (z[2] - z[0])*dy1)/(double) area*scale;
+    setup.depthB = ((z[2] - z[0])*dx1 - (z[1] - z[0])*dx2)/(double) area*scale;
+    setup.depthC = z[0] - (setup.depthA*(double) x[0] + setup.depthB*(double) y[0])/scale;
+
+    return true;
+}
+
+template<class Depth>
+void rasterizeFixedPoint(Triangle& triangle, uint32_t packedColor, Config& config, int subpixelBits, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& target) {
+    /* target's pixel (0, 0) corresponds to screen pixel (firstRow, firstColumn), as in scanTriangle() */
+    FixedPointSetup setup;
+    RasterCounters counts;
+
+    if(!isFixedPointRepresentable(triangle, config, subpixelBits)) {
+        rasterizeHalfSpace<Depth>(triangle, packedColor, config, firstRow, lastRow, firstColumn, lastColumn, target);
+        return;
+    }
+    if(!setUpFixedPoint(triangle, config, subpixelBits, firstRow, lastRow, firstColumn, lastColumn, setup)) {
+        return;
+    }
+
+    for(int row=setup.firstRow; row<=setup.lastRow; row++) {
+        typename Depth::Value* zBufferRow = target.getDepthRow<Depth>(row - firstRow) - firstColumn;
+        uint32_t* frameBufferRow = target.getColorRow(row - firstRow) - firstColumn;
+
+        int64_t edge0 = setup.edgeRow[0] + setup.edgeA[0]*setup.firstColumn;
+        int64_t edge1 = setup.edgeRow[1] + setup.edgeA[1]*setup.firstColumn;
+        int64_t edge2 = setup.edgeRow[2] + setup.edgeA[2]*setup.firstColumn;
+
+        counts.scanlines++;
+
+        /* coverage needs integer adds & one sign test per pixel */
+        for(int column=setup.firstColumn; column<=setup.lastColumn; column++) {
+            if((edge0 | edge1 | edge2) >= 0) {
+                counts.pixelsTested++;
+
+                double zp = setup.depthA*column + setup.depthB*row + setup.depthC;
+                typename Depth::Value depth = Depth::encode(zp, config);
+
+                if(zp>config.frontLimitZ && depth<zBufferRow[column]) {
+                    zBufferRow[column] = depth;
+                    frameBufferRow[column] = packedColor;
+                    counts.pixelsWritten++;
+                }
+            }
+
+            edge0 += setup.edgeA[0];
+            edge1 += setup.edgeA[1];
+            edge2 += setup.edgeA[2];
+        }
+
+        for(int j=0; j<3; j++) {
+            setup.edgeRow[j] += setup.edgeB[j];
+        }
+    }
+
+    target.addCounters(counts);
+}
+
+/*
+    multisample rasterizer: coverage & depth are evaluated at sampleCount fixed positions inside every pixel
+    (standard 2x, 4x & 8x patterns, in 1/16 pixel), while color is computed once per pixel & stored into
+    every covered sample passing depth test
+*/
+
+void getSampleOffsets(int sampleCount, double* offsetX, double* offsetY) {
+    static const int pattern2[2][2] = {{4, 4}, {-4, -4}};
+    static const int pattern4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+    static const int pattern8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+
+    const int (*pattern)[2] = (sampleCount == 2)? pattern2: (sampleCount == 4)? pattern4: pattern8;
+
+    for(int sample=0; sample<sampleCount; sample++) {
+        offsetX[sample] = pattern[sample][0]/16.0;
+        offsetY[sample] = pattern[sample][1]/16.0;
+    }
+}
+
+template<class Depth>
+void rasterizeMultisample(Triangle& triangle, uint32_t packedColor, Config& config, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& target) {
+    /* target's pixel (0, 0) corresponds to screen pixel (firstRow, firstColumn), as in scanTriangle() */
+    HalfSpaceSetup setup;
+    RasterCounters counts;
+    int sampleCount = target.getSampleCount();
+
+    /* every sample lies less than half a pixel away from its pixel's center */
+    if(!setUpHalfSpace(triangle, config, firstRow, lastRow, firstColumn, lastColumn, 0.5, setup)) {
+        return;
+    }
+
+    /* edge & depth increments from pixel center to every sample */
+    double offsetX[MAX_SAMPLE_COUNT], offsetY[MAX_SAMPLE_COUNT];
+    double sampleEdge[3][MAX_SAMPLE_COUNT], sampleDepth[MAX_SAMPLE_COUNT];
+
+    getSampleOffsets(sampleCount, offsetX, offsetY);
+
+    for(int sample=0; sample<sampleCount; sample++) {
+        for(int j=0; j<3; j++) {
+            sampleEdge[j][sample] = setup.edgeA[j]*offsetX[sample] + setup.edgeB[j]*offsetY[sample];
+        }
+        sampleDepth[sample] = setup.depthA*offsetX[sample] + setup.depthB*offsetY[sample];
+    }
+
+    for(int row=setup.firstRow; row<=setup.lastRow; row++) {
+        typename Depth::Value* zBufferRow = target.getDepthRow<Depth>(row - firstRow) - firstColumn*sampleCount;
+        uint32_t* frameBufferRow = target.getColorRow(row - firstRow) - firstColumn*sampleCount;
+
+        counts.scanlines++;
+
+        for(int column=setup.firstColumn; column<=setup.lastColumn; column++) {
+            double edgeValue[3];
+            for(int j=0; j<3; j++) {
+                edgeValue[j] = setup.edgeA[j]*column + setup.edgeB[j]*row + setup.edgeC[j];
+            }
+
+            int coverage = 0;
+            for(int sample=0; sample<sampleCount; sample++) {
+                if(isInsideEdge(edgeValue[0] + sampleEdge[0][sample], setup.bTopLeft[0]) && isInsideEdge(edgeValue[1] + sampleEdge[1][sample], setup.bTopLeft[1]) && isInsideEdge(edgeValue[2] + sampleEdge[2][sample], setup.bTopLeft[2])) {
+                    coverage |= 1<<sample;
+                }
+            }
+            if(coverage == 0) {
+                continue;
+            }
+            counts.pixelsTested++;
+
+            double zCenter = setup.depthA*column + setup.depthB*row + setup.depthC;
+            typename Depth::Value* zSamples = zBufferRow + column*sampleCount;
+            uint32_t* colorSamples = frameBufferRow + column*sampleCount;
+            bool bWritten = false;
+
+            for(int sample=0; sample<sampleCount; sample++) {
+                if(!(coverage & (1<<sample))) {
+                    continue;
+                }
+
+                double zp = zCenter + sampleDepth[sample];
+                typename Depth::Value depth = Depth::encode(zp, config);
+
+                if(zp>config.frontLimitZ && depth<zSamples[sample]) {
+                    zSamples[sample] = depth;
+                    colorSamples[sample] = packedColor;
+                    bWritten = true;
+                }
+            }
+            counts.pixelsWritten += bWritten? 1: 0;
+        }
+    }
+
+    target.addCounters(counts);
+}
+
+double getDepthSlopeX(Triangle& triangle) {
+    /* dz/dx of triangle's plane; infinite for triangles seen edge-on */
+    Point& p0 = triangle.corners[0];
+    Point& p1 = triangle.corners[1];
+    Point& p2 = triangle.corners[2];
+
+    double determinant = (p1.getX() - p0.getX())*(p2.getY() - p0.getY()) - (p2.getX() - p0.getX())*(p1.getY() - p0.getY());
+    if(determinant == 0.0) {
+        return INF;
+    }
+    return ((p1.getZ() - p0.getZ())*(p2.getY() - p0.getY()) - (p2.getZ() - p0.getZ())*(p1.getY() - p0.getY()))/determinant;
+}
+
+bool isTriangleCulled(Triangle& triangle, Config& config, RasterOptions& options, bool bMultisample, RasterCounters* counters) {
+    if(options.cullFaces==CULL_NONE && !options.bCullDegenerate && !options.bCullSmall) {
+        return false;
+    }
+
+    RasterCounters ignored;
+    if(counters == NULL) {
+        counters = &ignored;
+    }
+
+    Point& p0 = triangle.corners[0];
+    Point& p1 = triangle.corners[1];
+    Point& p2 = triangle.corners[2];
+
+    /* twice the signed screen space area, positive for counter-clockwise corners */
+    double area = (p1.getX() - p0.getX())*(p2.getY() - p0.getY()) - (p2.getX() - p0.getX())*(p1.getY() - p0.getY());
+
+    if(options.bCullDegenerate && area==0.0) {
+        counters->trianglesCulledDegenerate++;
+        return true;
+    }
+    if(options.cullFaces==CULL_BACK && area<0.0) {
+        counters->trianglesCulledBack++;
+        return true;
+    }
+    if(options.cullFaces==CULL_FRONT && area>0.0) {
+        counters->trianglesCulledFront++;
+        return true;
+    }
+
+    /* sub-pixel: bounding box encloses no pixel center (sample positions differ under multisampling) */
+    if(options.bCullSmall && !bMultisample) {
+        double maxX = max(p0.getX(), max(p1.getX(), p2.getX()));
+        double minX = min(p0.getX(), min(p1.getX(), p2.getX()));
+        double maxY = max(p0.getY(), max(p1.getY(), p2.getY()));
+        double minY = min(p0.getY(), min(p1.getY(), p2.getY()));
+
+        if(ceil((minX - config.leftX)/config.dx) > floor((maxX - config.leftX)/config.dx) || ceil((config.topY - maxY)/config.dy) > floor((config.topY - minY)/config.dy)) {
+            counters->trianglesCulledSmall++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool submitTriangle(Triangle& triangle, Config& config, RasterOptions& options, int sampleCount, RasterCounters* counters) {
+    /* counts & culls a triangle once as it enters stage 4, before it is binned into tiles or bands; false if culled */
+    if(counters != NULL) {
+        counters->trianglesSubmitted++;
+    }
+    return !isTriangleCulled(triangle, config, options, sampleCount>1, counters);
+}
+
+template<class Depth>
+void rasterizeTriangleAs(Triangle& triangle, uint32_t triangleIndex, Config& config, RasterOptions& options, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& target) {
+    /* passing pixels get triangle's color, or its index in visibility buffer mode; triangle passed submitTriangle() */
+    uint32_t packedColor = options.bVisibilityBuffer? triangleIndex: packColor(triangle.rgb);
+    int topScanline, bottomScanline, leftColumn, rightColumn;
+    bool bMultisample = target.getSampleCount() > 1;
+
+    if(target.hasHierarchicalZ()) {
+        /* rejecting triangle whose nearest corner lies behind every block it overlaps */
+        findScanlines(triangle, config, topScanline, bottomScanline);
+        findColumns(triangle, config, leftColumn, rightColumn);
+
+        /* samples of pixels next to bounding pixels may be covered as well */
+        if(bMultisample) {
+            topScanline--;
+            bottomScanline++;
+            leftColumn--;
+            rightColumn++;
+        }
+
+        topScanline = max(topScanline, firstRow) - firstRow;
+        bottomScanline = min(bottomScanline, lastRow) - firstRow;
+        leftColumn = max(leftColumn, firstColumn) - firstColumn;
+        rightColumn = min(rightColumn, lastColumn) - firstColumn;
+
+        if(topScanline>bottomScanline || leftColumn>rightColumn) {
+            return;
+        }
+
+        double nearestDepth = min(triangle.corners[0].getZ(), min(triangle.corners[1].getZ(), triangle.corners[2].getZ()));
+
+        /* scanTriangle() evaluates z at column centers up to half a pixel beyond span ends, i.e. slightly off triangle */
+        if(options.rasterizer==SCANLINE_RASTERIZER && !bMultisample) {
+            nearestDepth -= fabs(getDepthSlopeX(triangle))*config.dx;
+        }
+
+        if(isfinite(nearestDepth) && target.isRegionOccluded<Depth>(topScanline, bottomScanline, leftColumn, rightColumn, nearestDepth, config)) {
+            if(target.getCounters() != NULL) {
+                target.getCounters()->trianglesOccluded++;
+            }
+            return;
+        }
+    }
+
+    if(bMultisample) {
+        rasterizeMultisample<Depth>(triangle, packedColor, config, firstRow, lastRow, firstColumn, lastColumn, target);
+    } else if(options.rasterizer == HALF_SPACE_RASTERIZER) {
+        rasterizeHalfSpace<Depth>(triangle, packedColor, config, firstRow, lastRow, firstColumn, lastColumn, target);
+    } else if(options.rasterizer == FIXED_POINT_RASTERIZER) {
+        rasterizeFixedPoint<Depth>(triangle, packedColor, config, options.subpixelBits, firstRow, lastRow, firstColumn, lastColumn, target);
+    } else {
+        scanTriangle<Depth>(triangle, packedColor, config, firstRow, lastRow, firstColumn, lastColumn, target);
+    }
+
+    if(target.hasHierarchicalZ()) {
+        target.markBlocksDirty(topScanline, bottomScanline, leftColumn, rightColumn);
+    }
+}
+
+void rasterizeTriangle(Triangle& triangle, uint32_t triangleIndex, Config& config, RasterOptions& options, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& target) {
+    if(target.getDepthFormat() == DEPTH_FORMAT_DOUBLE) {
+        rasterizeTriangleAs<DoubleDepth>(triangle, triangleIndex, config, options, firstRow, lastRow, firstColumn, lastColumn, target);
+    } else if(target.getDepthFormat() == DEPTH_FORMAT_FLOAT32) {
+        rasterizeTriangleAs<Float32Depth>(triangle, triangleIndex, config, options, firstRow, lastRow, firstColumn, lastColumn, target);
+    } else {
+        rasterizeTriangleAs<Unorm24Depth>(triangle, triangleIndex, config, options, firstRow, lastRow, firstColumn, lastColumn, target);
+    }
+}
+
+bool isNearer(const Triangle& first, const Triangle& second) {
+    return min(first.corners[0].getZ(), min(first.corners[1].getZ(), first.corners[2].getZ())) < min(second.corners[0].getZ(), min(second.corners[1].getZ(), second.corners[2].getZ()));
+}
+
+void sortFrontToBack(vector<Triangle>& triangles) {
+    /* stable, so triangles at equal depth keep their submission order */
+    stable_sort(triangles.begin(), triangles.end(), isNearer);
+}
+
+void runScanConversion(vector<Triangle>& triangles, Config& config, RasterOptions& options, FrameBuffer& frameBuffer) {
+    /* serial z-buffer algorithm over whole screen */
+    for(size_t i=0; i<triangles.size(); i++) {
+        if(submitTriangle(triangles[i], config, options, frameBuffer.getSampleCount(), frameBuffer.getCounters())) {
+            rasterizeTriangle(triangles[i], (uint32_t) i, config, options, 0, config.screenHeight-1, 0, config.screenWidth-1, frameBuffer);
+        }
+    }
+}
+
+bool findTileBounds(Triangle& triangle, Config& config, int sampleCount, int& topScanline, int& bottomScanline, int& leftColumn, int& rightColumn) {
+    /* pixels a triangle may touch during scan conversion, used for binning it into screen tiles */
+    findScanlines(triangle, config, topScanline, bottomScanline);
+    findColumns(triangle, config, leftColumn, rightColumn);
+
+    /* samples of pixels next to bounding pixels may be covered as well */
+    if(sampleCount > 1) {
+        topScanline = max(topScanline - 1, 0);
+        bottomScanline = min(bottomScanline + 1, config.screenHeight - 1);
+        leftColumn = max(leftColumn - 1, 0);
+        rightColumn = min(rightColumn + 1, config.screenWidth - 1);
+    }
+    return topScanline<=bottomScanline && leftColumn<=rightColumn;
+}
+
+/* threads kept alive between frames; run() executes job(0) on caller & job(1 .. threadCount-1) on pool threads */
+class WorkerPool {
+    vector<thread> threads;
+    mutex poolMutex;
+    condition_variable jobReady, jobDone;
+
+    function<void(int)> job;
+    uint64_t generation;
+    int activeCount, remainingCount;
+    bool bStopping;
+
+    void serve(int workerIndex);
+
+public:
+    explicit WorkerPool(int threadCount) {
+        generation = 0;
+        activeCount = remainingCount = 0;
+        bStopping = false;
+
+        for(int i=1; i<threadCount; i++) {
+            threads.push_back(thread(&WorkerPool::serve, this, i));
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int getThreadCount() const {
+        return (int) threads.size() + 1;
+    }
+
+    void run(int threadCount, function<void(int)> job);
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            bStopping = true;
+        }
+        jobReady.notify_all();
+
+        for(size_t i=0; i<threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+};
+
+void WorkerPool::serve(int workerIndex) {
+    uint64_t seenGeneration = 0;
+    unique_lock<mutex> lock(poolMutex);
+
+    while(true) {
+        jobReady.wait(lock, [&]() {
+            return bStopping || generation!=seenGeneration;
+        });
+        if(bStopping) {
+            return;
+        }
+
+        seenGeneration = generation;
+        if(workerIndex >= activeCount) {
+            continue;
+        }
+
+        lock.unlock();
+        job(workerIndex);
+        lock.lock();
+
+        if(--remainingCount == 0) {
+            jobDone.notify_one();
+        }
+    }
+}
+
+void WorkerPool::run(int threadCount, function<void(int)> job) {
+    {
+        lock_guard<mutex> lock(poolMutex);
+        this->job = job;
+        activeCount = threadCount;
+        remainingCount = threadCount - 1;
+        generation++;
+    }
+    jobReady.notify_all();
+
+    job(0);
+
+    unique_lock<mutex> lock(poolMutex);
+    jobDone.wait(lock, [&]() {
+        return remainingCount == 0;
+    });
+}
+
+template<class RenderTile>
+void runTileWorkers(int tileColumns, int tileRows, Config& config, RasterOptions& options, FrameBuffer& frameBuffer, RenderTile renderTile) {
+    /* worker pool; every worker renders one tile at a time into its own tile-sized frame buffer */
+    int tileSize = options.tileSize;
+    atomic<int> nextTile(0);
+    vector<RasterCounters> workerCounters(options.threadCount);
+
+    auto worker = [&](int workerIndex) {
+        FrameBuffer tileBuffer;
+        tileBuffer.allocate(tileSize, tileSize, frameBuffer.getDepthFormat(), frameBuffer.getSampleCount());
+        tileBuffer.setHierarchicalZ(frameBuffer.hasHierarchicalZ());
+
+        if(frameBuffer.getCounters() != NULL) {
+            tileBuffer.setCounters(&workerCounters[workerIndex]);
+        }
+
+        for(int tile=nextTile++; tile<tileColumns*tileRows; tile=nextTile++) {
+            int firstRow = (tile/tileColumns)*tileSize;
+            int firstColumn = (tile%tileColumns)*tileSize;
+            int lastRow = min(firstRow+tileSize, config.screenHeight) - 1;
+            int lastColumn = min(firstColumn+tileSize, config.screenWidth) - 1;
+
+            tileBuffer.clear(config);
+            if(options.bVisibilityBuffer) {
+                tileBuffer.fillColor(VISIBILITY_NONE);
+            }
+
+            renderTile(tile, firstRow, lastRow, firstColumn, lastColumn, tileBuffer);
+
+            /* tiles are disjoint, so writing back needs no synchronization */
+            frameBuffer.copyRegion(tileBuffer, firstRow, firstColumn);
+        }
+    };
+
+    if(options.workerPool!=NULL && options.workerPool->getThreadCount()>=options.threadCount) {
+        options.workerPool->run(options.threadCount, worker);
+    } else {
+        vector<thread> workers;
+        for(int i=1; i<options.threadCount; i++) {
+            workers.push_back(thread(worker, i));
+        }
+        worker(0);
+
+        for(size_t i=0; i<workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    for(int i=0; i<options.threadCount; i++) {
+        frameBuffer.addCounters(workerCounters[i]);
+    }
+}
+
+void runTiledScanConversion(vector<Triangle>& triangles, Config& config, RasterOptions& options, FrameBuffer& frameBuffer) {
+    int tileSize = options.tileSize;
+
+    /* binning triangles that survive culling into screen tiles, preserving submission order inside every tile */
+    int tileColumns = (config.screenWidth + tileSize - 1)/tileSize;
+    int tileRows = (config.screenHeight + tileSize - 1)/tileSize;
+
+    vector< vector<int> > tileBins(tileColumns*tileRows);
+
+    for(size_t i=0; i<triangles.size(); i++) {
+        int topScanline, bottomScanline, leftColumn, rightColumn;
+
+        if(!submitTriangle(triangles[i], config, options, frameBuffer.getSampleCount(), frameBuffer.getCounters())) {
+            continue;
+        }
+        if(!findTileBounds(triangles[i], config, frameBuffer.getSampleCount(), topScanline, bottomScanline, leftColumn, rightColumn)) {
+            continue;
+        }
+
+        for(int tileRow=topScanline/tileSize; tileRow<=bottomScanline/tileSize; tileRow++) {
+            for(int tileColumn=leftColumn/tileSize; tileColumn<=rightColumn/tileSize; tileColumn++) {
+                tileBins[tileRow*tileColumns + tileColumn].push_back((int) i);
+            }
+        }
+    }
+
+    runTileWorkers(tileColumns, tileRows, config, options, frameBuffer, [&](int tile, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& tileBuffer) {
+        for(size_t i=0; i<tileBins[tile].size(); i++) {
+            rasterizeTriangle(triangles[tileBins[tile][i]], (uint32_t) tileBins[tile][i], config, options, firstRow, lastRow, firstColumn, lastColumn, tileBuffer);
+        }
+    });
+}
+
+void runRasterStage(vector<Triangle>& triangles, Config& config, RasterOptions& options, FrameBuffer& frameBuffer) {
+    /* submitting nearest triangles first lets hierarchical z reject more of the rest */
+    if(options.bFrontToBack) {
+        sortFrontToBack(triangles);
+    }
+
+    if(options.threadCount == 1) {
+        runScanConversion(triangles, config, options, frameBuffer);
+    } else {
+        runTiledScanConversion(triangles, config, options, frameBuffer);
+    }
+}
+
+/*
+    out-of-core streaming: stages 1-3 hand their output over in chunks, which are binned into screen tiles
+    right away; every tile fills one block of STREAM_BLOCK_TRIANGLES compact records in memory & full blocks
+    are appended to a spill file on disk, so memory is bounded by tile count rather than triangle count;
+    stage 4 then reads every tile's blocks back in submission order & scan converts tile by tile
+*/
+
+#define STREAM_BLOCK_TRIANGLES 256
+#define STREAM_SPILL_FILE_NAME "stream-bins.tmp"
+
+struct StreamedTriangle {
+    double corners[9];
+    uint32_t packedColor;
+    uint32_t id;
+};
+
+class TriangleBinner: public TriangleSink {
+    Config config;
+    RasterOptions options;
+    RasterCounters counters;
+    int tileSize, tileColumns, tileRows, sampleCount;
+
+    string spillFileName;
+    FILE* spillFile;
+    bool bFailed;
+    mutex spillMutex;
+
+    /* block being filled & file offsets of spilled blocks (in submission order) of every tile */
+    vector< vector<StreamedTriangle> > openBlocks;
+    vector< vector<uint64_t> > spilledBlocks;
+
+    uint64_t triangleCount, binnedCount, spilledBlockCount;
+
+    void spillBlock(int tile);
+
+public:
+    TriangleBinner() {
+        tileSize = tileColumns = tileRows = sampleCount = 0;
+        spillFile = NULL;
+        bFailed = false;
+        triangleCount = binnedCount = spilledBlockCount = 0;
+    }
+
+    TriangleBinner(const TriangleBinner&) = delete;
+    TriangleBinner& operator=(const TriangleBinner&) = delete;
+
+    bool open(string spillFileName, Config& config, RasterOptions& options, int sampleCount);
+    void consume(vector<Triangle>& triangles);
+    bool readBlock(int tile, size_t block, vector<Triangle>& triangles);
+    void close();
+
+    int getTileColumns() const {
+        return tileColumns;
+    }
+
+    int getTileRows() const {
+        return tileRows;
+    }
+
+    size_t getBlockCount(int tile) const {
+        return spilledBlocks[tile].size() + (openBlocks[tile].empty()? 0: 1);
+    }
+
+    /* triangles handed over, tile bin entries (a triangle goes into every tile it overlaps) & bytes on disk */
+    uint64_t getTriangleCount() const {
+        return triangleCount;
+    }
+
+    uint64_t getBinnedCount() const {
+        return binnedCount;
+    }
+
+    uint64_t getSpilledBytes() const {
+        return spilledBlockCount*STREAM_BLOCK_TRIANGLES*sizeof(StreamedTriangle);
+    }
+
+    /* submitted & culled triangles, counted while binning */
+    const RasterCounters& getCounters() const {
+        return counters;
+    }
+
+    bool hasFailed() const {
+        return bFailed;
+    }
+
+    ~TriangleBinner() {
+        close();
+    }
+};
+
+bool TriangleBinner::open(string spillFileName, Config& config, RasterOptions& options, int sampleCount) {
+    close();
+
+    this->config = config;
+    this->options = options;
+    this->tileSize = options.tileSize;
+    this->sampleCount = sampleCount;
+    this->spillFileName = spillFileName;
+
+    tileColumns = (config.screenWidth + tileSize - 1)/tileSize;
+    tileRows = (config.screenHeight + tileSize - 1)/tileSize;
+
+    openBlocks.assign(tileColumns*tileRows, vector<StreamedTriangle>());
+    spilledBlocks.assign(tileColumns*tileRows, vector<uint64_t>());
+    triangleCount = binnedCount = spilledBlockCount = 0;
+    counters = RasterCounters();
+    bFailed = false;
+
+    spillFile = fopen(spillFileName.c_str(), "w+b");
+    return spillFile != NULL;
+}
+
+void TriangleBinner::spillBlock(int tile) {
+    /* blocks are appended one after another, so offset follows from number of blocks spilled so far */
+    vector<StreamedTriangle>& block = openBlocks[tile];
+
+    if(fwrite(&block[0], sizeof(StreamedTriangle), block.size(), spillFile) != block.size()) {
+        bFailed = true;
+    }
+    spilledBlocks[tile].push_back(spilledBlockCount*STREAM_BLOCK_TRIANGLES*sizeof(StreamedTriangle));
+    spilledBlockCount++;
+
+    /* capacity is kept for next block of this tile */
+    block.clear();
+}
+
+void TriangleBinner::consume(vector<Triangle>& triangles) {
+    for(size_t i=0; i<triangles.size(); i++) {
+        int topScanline, bottomScanline, leftColumn, rightColumn;
+
+        triangleCount++;
+        if(!submitTriangle(triangles[i], config, options, sampleCount, &counters)) {
+            continue;
+        }
+        if(!findTileBounds(triangles[i], config, sampleCount, topScanline, bottomScanline, leftColumn, rightColumn)) {
+            continue;
+        }
+
+        StreamedTriangle record;
+        for(int j=0; j<3; j++) {
+            record.corners[3*j] = triangles[i].corners[j].getX();
+            record.corners[3*j + 1] = triangles[i].corners[j].getY();
+            record.corners[3*j + 2] = triangles[i].corners[j].getZ();
+        }
+        record.packedColor = packColor(triangles[i].rgb);
+        record.id = triangles[i].id;
+
+        for(int tileRow=topScanline/tileSize; tileRow<=bottomScanline/tileSize; tileRow++) {
+            for(int tileColumn=leftColumn/tileSize; tileColumn<=rightColumn/tileSize; tileColumn++) {
+                int tile = tileRow*tileColumns + tileColumn;
+
+                openBlocks[tile].push_back(record);
+                binnedCount++;
+
+                if(openBlocks[tile].size() == STREAM_BLOCK_TRIANGLES) {
+                    spillBlock(tile);
+                }
+            }
+        }
+    }
+}
+
+bool TriangleBinner::readBlock(int tile, size_t block, vector<Triangle>& triangles) {
+    /* block-th block of tile: spilled blocks first, then the one still in memory; safe to call concurrently */
+    vector<StreamedTriangle> spilled;
+    const StreamedTriangle* records;
+    size_t recordCount;
+
+    if(block < spilledBlocks[tile].size()) {
+        spilled.resize(STREAM_BLOCK_TRIANGLES);
+
+        lock_guard<mutex> lock(spillMutex);
+#ifndef _WIN32
+        bool bRead = fseeko(spillFile, (off_t) spilledBlocks[tile][block], SEEK_SET) == 0;
+#else
+        bool bRead = _fseeki64(spillFile, (__int64) spilledBlocks[tile][block], SEEK_SET) == 0;
+#endif
+        if(!bRead || fread(&spilled[0], sizeof(StreamedTriangle), STREAM_BLOCK_TRIANGLES, spillFile) != STREAM_BLOCK_TRIANGLES) {
+            return false;
+        }
+        records = &spilled[0];
+        recordCount = STREAM_BLOCK_TRIANGLES;
+    } else {
+        records = &openBlocks[tile][0];
+        recordCount = openBlocks[tile].size();
+    }
+
+    triangles.resize(recordCount);
+    for(size_t i=0; i<recordCount; i++) {
+        for(int j=0; j<3; j++) {
+            triangles[i].corners[j] = Point(records[i].corners[3*j], records[i].corners[3*j + 1], records[i].corners[3*j + 2]);
+        }
+        triangles[i].rgb = unpackColor(records[i].packedColor);
+        triangles[i].id = records[i].id;
+    }
+    return true;
+}
+
+void TriangleBinner::close() {
+    if(spillFile == NULL) {
+        return;
+    }
+
+    fclose(spillFile);
+    remove(spillFileName.c_str());
+    spillFile = NULL;
+
+    vector< vector<StreamedTriangle> >().swap(openBlocks);
+    vector< vector<uint64_t> >().swap(spilledBlocks);
+}
+
+bool runStreamedScanConversion(TriangleBinner& binner, Config& config, RasterOptions& options, FrameBuffer& frameBuffer) {
+    /* same tile workers as runTiledScanConversion(), reading one block of a tile at a time */
+    atomic<bool> bFailed(false);
+
+    runTileWorkers(binner.getTileColumns(), binner.getTileRows(), config, options, frameBuffer, [&](int tile, int firstRow, int lastRow, int firstColumn, int lastColumn, FrameBuffer& tileBuffer) {
+        vector<Triangle> triangles;
+
+        for(size_t block=0; block<binner.getBlockCount(tile); block++) {
+            if(!binner.readBlock(tile, block, triangles)) {
+                bFailed = true;
+                return;
+            }
+
+            for(size_t i=0; i<triangles.size(); i++) {
+                rasterizeTriangle(triangles[i], 0, config, options, firstRow, lastRow, firstColumn, lastColumn, tileBuffer);
+            }
+        }
+    });
+    return !bFailed;
+}
+
+uint64_t getPeakMemoryBytes() {
+    /* peak resident set size of the process so far, 0 where it is not available */
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (uint64_t) usage.ru_maxrss;
+#else
+    return (uint64_t) usage.ru_maxrss*1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+double getSecondsSince(chrono::steady_clock::time_point& start) {
+    /* returns seconds elapsed since start & restarts it */
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(now - start).count();
+
+    start = now;
+    return seconds;
+}
+
+/*
+    pipelined stages: stages 1, 2 & 3 run on threads of their own while stage 4 runs on one worker per band
+    of screen rows; batches of up to PIPELINE_BATCH_TRIANGLES triangles are handed from stage to stage
+    through bounded single producer, single consumer queues & every band worker sees every batch in
+    submission order. batches come from a fixed pool & are reused once every band is done with them, so
+    memory is bounded by batch & queue sizes rather than triangle count. queues count how full they were
+    on every push & how often either side had to wait, which tells the bottleneck stage
+*/
+
+#define PIPELINE_BATCH_TRIANGLES 1024
+#define PIPELINE_QUEUE_CAPACITY 8
+#define PIPELINE_BATCH_COUNT (4*PIPELINE_QUEUE_CAPACITY)
+#define PIPELINE_STAGE_COUNT 4  // modeling, view, projection & scan conversion; queue i feeds stage i+1
+#define PIPELINE_SPIN_COUNT 64
+#define PIPELINE_SLEEP_MICROSECONDS 50
+
+struct TriangleBatch {
+    vector<Triangle> triangles;
+    atomic<int> pendingBands;  // band workers yet to scan convert batch, 0 once it can be refilled
+
+    TriangleBatch(): pendingBands(0) {
+    }
+};
+
+struct QueueCounters {
+    uint64_t pushes;
+    uint64_t occupancySum;  // batches already waiting, summed over pushes
+    uint64_t fullWaits;  // pushes that found queue full
+    uint64_t emptyWaits;  // pops that found queue empty
+
+    QueueCounters() {
+        pushes = occupancySum = fullWaits = emptyWaits = 0;
+    }
+
+    void add(const QueueCounters& counters) {
+        pushes += counters.pushes;
+        occupancySum += counters.occupancySum;
+        fullWaits += counters.fullWaits;
+        emptyWaits += counters.emptyWaits;
+    }
+};
+
+inline void waitForPipeline(int& spins) {
+    /* spinning briefly, then sleeping, so that waiting stages leave cores to busy ones */
+    if(++spins < PIPELINE_SPIN_COUNT) {
+        this_thread::yield();
+    } else {
+        this_thread::sleep_for(chrono::microseconds(PIPELINE_SLEEP_MICROSECONDS));
+    }
+}
+
+/* lock-free ring of batches between one producer & one consumer thread; NULL marks end of stream */
+class BatchQueue {
+    TriangleBatch* slots[PIPELINE_QUEUE_CAPACITY];
+    atomic<uint64_t> head;  // next slot to pop, written by consumer only
+    atomic<uint64_t> tail;  // next slot to push, written by producer only
+
+    /* each side writes its own counters only */
+    uint64_t pushes, occupancySum, fullWaits, emptyWaits;
+
+public:
+    BatchQueue(): head(0), tail(0) {
+        pushes = occupancySum = fullWaits = emptyWaits = 0;
+    }
+
+    BatchQueue(const BatchQueue&) = delete;
+    BatchQueue& operator=(const BatchQueue&) = delete;
+
+    void push(TriangleBatch* batch) {
+        uint64_t next = tail.load(memory_order_relaxed);
+        uint64_t first = head.load(memory_order_acquire);
+
+        if(next - first == PIPELINE_QUEUE_CAPACITY) {
+            fullWaits++;
+            for(int spins=0; next - (first = head.load(memory_order_acquire)) == PIPELINE_QUEUE_CAPACITY; ) {
+                waitForPipeline(spins);
+            }
+        }
+
+        pushes++;
+        occupancySum += next - first;
+
+        slots[next%PIPELINE_QUEUE_CAPACITY] = batch;
+        tail.store(next + 1, memory_order_release);
+    }
+
+    TriangleBatch* pop() {
+        uint64_t first = head.load(memory_order_relaxed);
+
+        if(tail.load(memory_order_acquire) == first) {
+            emptyWaits++;
+            for(int spins=0; tail.load(memory_order_acquire) == first; ) {
+                waitForPipeline(spins);
+            }
+        }
+
+        TriangleBatch* batch = slots[first%PIPELINE_QUEUE_CAPACITY];
+        head.store(first + 1, memory_order_release);
+        return batch;
+    }
+
+    QueueCounters getCounters() const {
+        /* only meaningful once both sides are done */
+        QueueCounters counters;
+        counters.pushes = pushes;
+        counters.occupancySum = occupancySum;
+        counters.fullWaits = fullWaits;
+        counters.emptyWaits = emptyWaits;
+        return counters;
+    }
+};
+
+struct PipelineCounters {
+    int bandCount;
+    double busySeconds[PIPELINE_STAGE_COUNT];  // summed over threads of stage, waiting on queues excluded
+    QueueCounters queues[PIPELINE_STAGE_COUNT - 1];  // band queues are summed into last one
+
+    PipelineCounters() {
+        bandCount = 0;
+        for(int i=0; i<PIPELINE_STAGE_COUNT; i++) {
+            busySeconds[i] = 0.0;
+        }
+    }
+};
+
+int getPipelineBottleneck(PipelineCounters& counters) {
+    /* stage with most busy time per thread */
+    int bottleneck = 0;
+    double bottleneckSeconds = -1.0;
+
+    for(int i=0; i<PIPELINE_STAGE_COUNT; i++) {
+        double seconds = counters.busySeconds[i]/(i+1<PIPELINE_STAGE_COUNT? 1: max(counters.bandCount, 1));
+
+        if(seconds > bottleneckSeconds) {
+            bottleneck = i;
+            bottleneckSeconds = seconds;
+        }
+    }
+    return bottleneck;
+}
+
+void runPipelinedModelingStage(Scene& scene, ColorGenerator& generator, vector<TriangleBatch>& batches, int bandCount, BatchQueue& output, double& busySeconds) {
+    /* stage1 as in runModelingStage(), drawing random colors of generator in drawing order & filling batches round robin */
+    Transformation modelTransformation;
+    uint32_t currentMatrixIndex = scene.matrixCount;
+    uint32_t i = 0;
+
+    vector<Point> transformedVertices;
+    size_t batchCount = 0;
+    TriangleBatch* batch = NULL;
+
+    double waitSeconds = 0.0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point waitStart;
+
+    auto emit = [&](Triangle& triangle) {
+        if(batch == NULL) {
+            /* oldest batch of pool may still be scan converted */
+            batch = &batches[batchCount++%batches.size()];
+
+            waitStart = chrono::steady_clock::now();
+            for(int spins=0; batch->pendingBands.load(memory_order_acquire) != 0; ) {
+                waitForPipeline(spins);
+            }
+            waitSeconds += getSecondsSince(waitStart);
+
+            batch->triangles.clear();
+        }
+
+        triangle.rgb = getRandomColor(generator);
+        batch->triangles.push_back(triangle);
+
+        if(batch->triangles.size() == PIPELINE_BATCH_TRIANGLES) {
+            batch->pendingBands.store(bandCount, memory_order_relaxed);
+
+            waitStart = chrono::steady_clock::now();
+            output.push(batch);
+            waitSeconds += getSecondsSince(waitStart);
+
+            batch = NULL;
+        }
+    };
+
+    for(uint32_t d=0; d<scene.drawCount; d++) {
+        const SceneDraw& draw = scene.draws[d];
+
+        if(draw.matrixIndex != currentMatrixIndex) {
+            currentMatrixIndex = draw.matrixIndex;
+            modelTransformation = Transformation(scene.matrices+16*currentMatrixIndex);
+        }
+
+        Triangle triangle;
+
+        if(draw.vertexCount > 0) {
+            transformedVertices.resize(draw.vertexCount);
+
+            for(uint32_t v=0; v<draw.vertexCount; v++) {
+                const double* vertex = scene.indexedVertices+3*(draw.firstVertex + v);
+
+                transformedVertices[v] = modelTransformation*Point(vertex[0], vertex[1], vertex[2]);
+                transformedVertices[v].scale();
+            }
+
+            for(uint32_t t=0; t<draw.triangleCount; t++, i++) {
+                const uint32_t* indices = scene.indices+3*(draw.firstTriangle + t);
+
+                for(int j=0; j<3; j++) {
+                    triangle.corners[j] = transformedVertices[indices[j]];
+                }
+                triangle.id = i;
+                emit(triangle);
+            }
+            continue;
+        }
+
+        for(uint32_t t=0; t<draw.triangleCount; t++, i++) {
+            const double* corners = scene.vertices+9*(draw.firstTriangle + t);
+
+            for(int j=0; j<3; j++) {
+                triangle.corners[j] = modelTransformation*Point(corners[3*j], corners[3*j+1], corners[3*j+2]);
+                triangle.corners[j].scale();
+            }
+            triangle.id = i;
+            emit(triangle);
+        }
+    }
+
+    if(batch != NULL) {
+        batch->pendingBands.store(bandCount, memory_order_relaxed);
+        output.push(batch);
+    }
+    output.push(NULL);
+    busySeconds = getSecondsSince(start) - waitSeconds;
+}
+
+void runPipelinedTransformStage(Transformation transformation, Config& config, bool bProjection, bool bClipping, BatchQueue& input, vector<BatchQueue*>& outputs, ClipCounters& counters, double& busySeconds) {
+    /* stage2 (view transformation) or stage3 (projection transformation & clipping) over batches in place */
+    double waitSeconds = 0.0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point waitStart;
+
+    for(TriangleBatch* batch=input.pop(); ; batch=input.pop()) {
+        if(batch != NULL) {
+            if(bProjection) {
+                runProjectionStage(batch->triangles, transformation, config, bClipping, counters);
+            } else {
+                transformTriangles(batch->triangles, transformation);
+            }
+        }
+
+        waitStart = chrono::steady_clock::now();
+        for(size_t i=0; i<outputs.size(); i++) {
+            outputs[i]->push(batch);
+        }
+        waitSeconds += getSecondsSince(waitStart);
+
+        if(batch == NULL) {
+            break;
+        }
+    }
+    busySeconds = getSecondsSince(start) - waitSeconds;
+}
+
+void runPipelinedStages(Scene& scene, ColorGenerator& generator, Transformation viewTransformation, Transformation projectionTransformation, Config& config, RasterOptions& options, bool bClipping, FrameBuffer& frameBuffer, ClipCounters& clipCounters, PipelineCounters& counters, uint64_t& trianglesOut) {
+    /* frameBuffer must be allocated & cleared; with one band, stage 4 draws into it directly */
+    int bandCount = max(1, min(options.threadCount, config.screenHeight));
+    int bandHeight = (config.screenHeight + bandCount - 1)/bandCount;
+    bandCount = (config.screenHeight + bandHeight - 1)/bandHeight;
+
+    vector<TriangleBatch> batches(PIPELINE_BATCH_COUNT);
+    BatchQueue modeledQueue, viewedQueue;
+    vector< unique_ptr<BatchQueue> > bandQueues(bandCount);
+    vector<BatchQueue*> viewedOutputs(1, &viewedQueue), projectedOutputs;
+
+    for(int i=0; i<bandCount; i++) {
+        bandQueues[i].reset(new BatchQueue());
+        projectedOutputs.push_back(bandQueues[i].get());
+    }
+
+    ClipCounters viewClipCounters;
+    vector<FrameBuffer> bandBuffers(bandCount);
+    vector<RasterCounters> bandCounters(bandCount);
+    vector<double> bandBusySeconds(bandCount, 0.0);
+    vector<uint64_t> bandTriangles(bandCount, 0);
+
+    thread modelingThread(runPipelinedModelingStage, ref(scene), ref(generator), ref(batches), bandCount, ref(modeledQueue), ref(counters.busySeconds[0]));
+    thread viewThread(runPipelinedTransformStage, viewTransformation, ref(config), false, false, ref(modeledQueue), ref(viewedOutputs), ref(viewClipCounters), ref(counters.busySeconds[1]));
+    thread projectionThread(runPipelinedTransformStage, projectionTransformation, ref(config), true, bClipping, ref(viewedQueue), ref(projectedOutputs), ref(clipCounters), ref(counters.busySeconds[2]));
+
+    auto worker = [&](int band) {
+        int firstRow = band*bandHeight;
+        int lastRow = min(firstRow+bandHeight, config.screenHeight) - 1;
+
+        FrameBuffer& bandBuffer = bandBuffers[band];
+        FrameBuffer& target = (bandCount == 1)? frameBuffer: bandBuffer;
+
+        if(bandCount > 1) {
+            bandBuffer.allocate(config.screenWidth, lastRow - firstRow + 1, frameBuffer.getDepthFormat(), frameBuffer.getSampleCount());
+            bandBuffer.setHierarchicalZ(frameBuffer.hasHierarchicalZ());
+            bandBuffer.setCounters(frameBuffer.getCounters()!=NULL? &bandCounters[band]: NULL);
+            bandBuffer.clear(config);
+        }
+
+        double waitSeconds = 0.0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        chrono::steady_clock::time_point waitStart = start;
+
+        /* every band culls every triangle, but only first band counts them */
+        RasterCounters* submitCounters = (band == 0)? target.getCounters(): NULL;
+
+        for(TriangleBatch* batch=bandQueues[band]->pop(); batch!=NULL; batch=bandQueues[band]->pop()) {
+            waitSeconds += getSecondsSince(waitStart);
+
+            for(size_t i=0; i<batch->triangles.size(); i++) {
+                int topScanline, bottomScanline, leftColumn, rightColumn;
+
+                if(!submitTriangle(batch->triangles[i], config, options, frameBuffer.getSampleCount(), submitCounters)) {
+                    continue;
+                }
+
+                /* same bounds as binning into tiles, so that counters match tiled scan conversion */
+                if(bandCount>1 && (!findTileBounds(batch->triangles[i], config, frameBuffer.getSampleCount(), topScanline, bottomScanline, leftColumn, rightColumn) || bottomScanline<firstRow || topScanline>lastRow)) {
+                    continue;
+                }
+                rasterizeTriangle(batch->triangles[i], 0, config, options, firstRow, lastRow, 0, config.screenWidth-1, target);
+            }
+            bandTriangles[band] += batch->triangles.size();
+
+            batch->pendingBands.fetch_sub(1, memory_order_release);
+            waitStart = chrono::steady_clock::now();
+        }
+        waitSeconds += getSecondsSince(waitStart);
+        bandBusySeconds[band] = getSecondsSince(start) - waitSeconds;
+    };
+
+    if(options.workerPool!=NULL && options.workerPool->getThreadCount()>=bandCount) {
+        options.workerPool->run(bandCount, worker);
+    } else {
+        vector<thread> workers;
+        for(int i=1; i<bandCount; i++) {
+            workers.push_back(thread(worker, i));
+        }
+        worker(0);
+
+        for(size_t i=0; i<workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    modelingThread.join();
+    viewThread.join();
+    projectionThread.join();
+
+    counters.bandCount = bandCount;
+    counters.queues[0] = modeledQueue.getCounters();
+    counters.queues[1] = viewedQueue.getCounters();
+
+    /* copied back serially, as hierarchical z blocks of frame buffer may straddle bands */
+    for(int i=0; i<bandCount && bandCount>1; i++) {
+        frameBuffer.copyRegion(bandBuffers[i], i*bandHeight, 0);
+    }
+
+    for(int i=0; i<bandCount; i++) {
+        frameBuffer.addCounters(bandCounters[i]);
+        counters.queues[2].add(bandQueues[i]->getCounters());
+        counters.busySeconds[3] += bandBusySeconds[i];
+    }
+    trianglesOut = bandTriangles[0];
+}
+
+/*
+    visibility buffer: in this mode stage 4 writes index of winning triangle (instead of its color) into
+    color plane; resolveVisibility() then shades visible pixels only & optionally writes visibility.bin,
+    holding a 16 byte header (VBUF magic, version, width, height) followed by one record per pixel in row
+    order: scene triangle id (VISIBILITY_NONE where nothing was drawn) & screen space barycentric weights
+    of triangle's first two corners as float32
+*/
+
+#define VISIBILITY_FILE_MAGIC 0x46554256u  // "VBUF"
+#define VISIBILITY_FILE_VERSION 1u
+
+struct VisibilityFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+};
+
+bool resolveVisibility(vector<Triangle>& triangles, Config& config, FrameBuffer& frameBuffer, string fileName) {
+    ofstream output;
+
+    if(!fileName.empty()) {
+        output.open(fileName.c_str(), ios::out | ios::binary);
+        if(!output.is_open()) {
+            return false;
+        }
+
+        VisibilityFileHeader header = {VISIBILITY_FILE_MAGIC, VISIBILITY_FILE_VERSION, (uint32_t) config.screenWidth, (uint32_t) config.screenHeight};
+        output.write((const char*) &header, sizeof(header));
+    }
+
+    const size_t recordSize = sizeof(uint32_t) + 2*sizeof(float);
+    vector<char> rowBuffer(config.screenWidth*recordSize);
+
+    for(int row=0; row<config.screenHeight; row++) {
+        uint32_t* frameBufferRow = frameBuffer.getColorRow(row);
+        double y = config.topY - row*config.dy;
+
+        for(int column=0; column<config.screenWidth; column++) {
+            uint32_t index = frameBufferRow[column];
+            uint32_t id = VISIBILITY_NONE;
+            float weights[2] = {0.0f, 0.0f};
+
+            if(index == VISIBILITY_NONE) {
+                frameBufferRow[column] = packColor(Color{0, 0, 0});
+            } else {
+                Triangle& triangle = triangles[index];
+                frameBufferRow[column] = packColor(triangle.rgb);
+                id = triangle.id;
+
+                if(output.is_open()) {
+                    double x = config.leftX + column*config.dx;
+                    Point& p0 = triangle.corners[0];
+                    Point& p1 = triangle.corners[1];
+                    Point& p2 = triangle.corners[2];
+
+                    double determinant = (p1.getY() - p2.getY())*(p0.getX() - p2.getX()) + (p2.getX() - p1.getX())*(p0.getY() - p2.getY());
+                    weights[0] = (float) (((p1.getY() - p2.getY())*(x - p2.getX()) + (p2.getX() - p1.getX())*(y - p2.getY()))/determinant);
+                    weights[1] = (float) (((p2.getY() - p0.getY())*(x - p2.getX()) + (p0.getX() - p2.getX())*(y - p2.getY()))/determinant);
+                }
+            }
+
+            char* record = &rowBuffer[column*recordSize];
+            memcpy(record, &id, sizeof(id));
+            memcpy(record + sizeof(id), weights, sizeof(weights));
+        }
+
+        if(output.is_open()) {
+            output.write(&rowBuffer[0], rowBuffer.size());
+        }
+    }
+
+    if(output.is_open()) {
+        output.close();
+        return !output.fail();
+    }
+    return true;
+}
+
+/*
+    pipeline statistics: wall time & triangle counts per stage together with clipping & stage 4 counters,
+    written as JSON next to out.bmp; kernels count into locals, so disabled statistics cost one branch per triangle
+*/
+
+/*
+    shadow maps: every light of lights.txt renders scene depth from its own point of view through stages
+    2-4 (light's view & projection matrices, depth only); after stage 4 every drawn pixel is carried from
+    camera's NDC into each light's clip space by one combined matrix & darkened where a map holds a
+    surface nearer to that light
+*/
+
+#define SHADOW_LIGHTS_FILE_NAME "lights.txt"
+#define SHADOW_MAP_SIZE 1024
+#define SHADOW_AMBIENT 0.3      // fraction of color kept where every light is blocked
+#define SHADOW_DEPTH_BIAS 0.01  // relative to distance of occluder, against self shadowing
+
+struct ShadowMap {
+    Camera light;
+    Transformation viewTransformation, projectionTransformation;
+    Config config;
+    FrameBuffer depth;
+};
+
+bool readLightsFile(string fileName, vector<Camera>& lights) {
+    /* one light per line: eyeX eyeY eyeZ lookX lookY lookZ upX upY upZ fovY near far; blank & '#' lines are skipped */
+    ifstream input(fileName.c_str());
+    if(!input.is_open()) {
+        cout << fileName << ": cannot read lights" << endl;
+        return false;
+    }
+
+    string line;
+    while(getline(input, line)) {
+        if(line.find_first_not_of(" \t\r") == string::npos || line[line.find_first_not_of(" \t\r")] == '#') {
+            continue;
+        }
+
+        istringstream fields(line);
+        Camera light;
+
+        if(!(fields >> light.eyeX >> light.eyeY >> light.eyeZ >> light.lookX >> light.lookY >> light.lookZ >> light.upX >> light.upY >> light.upZ >> light.fovY >> light.near >> light.far) || light.near<=0.0 || light.far<=light.near) {
+            cout << fileName << ": invalid light \"" << line << "\"" << endl;
+            return false;
+        }
+        light.aspectRatio = 1.0;
+        lights.push_back(light);
+    }
+    input.close();
+
+    if(lights.empty()) {
+        cout << fileName << ": no light defined" << endl;
+        return false;
+    }
+    return true;
+}
+
+void setUpShadowMap(Camera& light, int mapSize, ShadowMap& map) {
+    /* square map over whole NDC square & depth range */
+    map.light = light;
+    map.viewTransformation.generateViewMatrix(Point(light.eyeX, light.eyeY, light.eyeZ), Point(light.lookX, light.lookY, light.lookZ), Point(light.upX, light.upY, light.upZ));
+    map.projectionTransformation.generateProjectionMatrix(light.fovY, light.aspectRatio, light.near, light.far);
+
+    map.config.screenWidth = map.config.screenHeight = mapSize;
+    map.config.leftLimitX = map.config.bottomLimitY = -1.0;
+    map.config.frontLimitZ = -1.0;
+    map.config.rearLimitZ = 1.0;
+    map.config.sampleCount = 1;
+    setUpConfig(map.config);
+}
+
+void renderShadowMap(vector<Triangle>& lightTriangles, RasterOptions& options, ShadowMap& map) {
+    /* same scan conversion as the camera pass; colors are written but never read */
+    RasterOptions lightOptions = options;
+    lightOptions.bVisibilityBuffer = false;
+
+    map.depth.allocate(map.config.screenWidth, map.config.screenHeight, DEPTH_FORMAT_FLOAT32, 1);
+    map.depth.setHierarchicalZ(options.bHierarchicalZ);
+    map.depth.setCounters(NULL);
+    map.depth.clear(map.config);
+
+    runRasterStage(lightTriangles, map.config, lightOptions, map.depth);
+}
+
+inline double getLightDistance(double depth, Camera& light) {
+    /* inverting projection's depth mapping: NDC z back to distance along light's viewing direction */
+    return 2.0*light.far*light.near/((light.far + light.near) - depth*(light.far - light.near));
+}
+
+void applyShadowMaps(Config& config, FrameBuffer& frameBuffer, Transformation cameraTransformation, vector<ShadowMap>& maps) {
+    /* cameraTransformation is camera's P*V; frameBuffer must be resolved (one sample per pixel) */
+    vector<Transformation> ndcToLight(maps.size());
+    Transformation inverseCamera = cameraTransformation.inverse();
+
+    for(size_t i=0; i<maps.size(); i++) {
+        ndcToLight[i] = maps[i].projectionTransformation*maps[i].viewTransformation*inverseCamera;
+    }
+
+    for(int row=0; row<config.screenHeight; row++) {
+        uint32_t* colorRow = frameBuffer.getColorRow(row);
+
+        for(int column=0; column<config.screenWidth; column++) {
+            if(!frameBuffer.isDepthWritten(row, column, config)) {
+                continue;
+            }
+
+            Point ndc(config.leftX + column*config.dx, config.topY - row*config.dy, frameBuffer.getDepth(row, column, config));
+            int blockedCount = 0;
+
+            for(size_t i=0; i<maps.size(); i++) {
+                Config& mapConfig = maps[i].config;
+                Point clip = ndcToLight[i]*ndc;
+
+                /* pixels behind a light or outside its map are lit by it */
+                if(clip.getW() <= 0.0) {
+                    continue;
+                }
+
+                double x = clip.getX()/clip.getW(), y = clip.getY()/clip.getW(), z = clip.getZ()/clip.getW();
+                if(x<-1.0 || x>1.0 || y<-1.0 || y>1.0 || z>1.0) {
+                    continue;
+                }
+
+                int mapColumn = min(max((int) round((x - mapConfig.leftX)/mapConfig.dx), 0), mapConfig.screenWidth - 1);
+                int mapRow = min(max((int) round((mapConfig.topY - y)/mapConfig.dy), 0), mapConfig.screenHeight - 1);
+
+                if(!maps[i].depth.isDepthWritten(mapRow, mapColumn, mapConfig)) {
+                    continue;
+                }
+
+                double occluderDistance = getLightDistance(maps[i].depth.getDepth(mapRow, mapColumn, mapConfig), maps[i].light);
+                if(getLightDistance(z, maps[i].light) > occluderDistance*(1.0 + SHADOW_DEPTH_BIAS)) {
+                    blockedCount++;
+                }
+            }
+
+            if(blockedCount == 0) {
+                continue;
+            }
+
+            double factor = 1.0 - (1.0 - SHADOW_AMBIENT)*blockedCount/maps.size();
+            Color color = unpackColor(colorRow[column]);
+
+            color.redValue = (int) round(color.redValue*factor);
+            color.greenValue = (int) round(color.greenValue*factor);
+            color.blueValue = (int) round(color.blueValue*factor);
+            colorRow[column] = packColor(color);
+        }
+    }
+}
+
+struct StageStats {
+    double seconds;
+    uint64_t trianglesIn;
+    uint64_t trianglesOut;
+
+    StageStats() {
+        seconds = 0.0;
+        trianglesIn = trianglesOut = 0;
+    }
+};
+
+struct PipelineStats {
+    StageStats loading, modeling, viewing, projection, fused, scanConversion, shadows, saving;
+    StageStats pipelined;  // stages 1-4 overlapped
+    bool bFused;
+    int lightCount;
+    ClipCounters clipCounters;
+    RasterCounters rasterCounters;
+    uint64_t coveredPixels;
+
+    /* streaming mode: tile bin entries & bytes spilled to disk */
+    bool bStreamed;
+    uint64_t binnedTriangles;
+    uint64_t spilledBytes;
+
+    /* pipelined mode: busy time of stages & occupancy of queues between them */
+    bool bPipelined;
+    PipelineCounters pipelineCounters;
+
+    PipelineStats() {
+        bFused = false;
+        bPipelined = false;
+        lightCount = 0;
+        coveredPixels = 0;
+        bStreamed = false;
+        binnedTriangles = spilledBytes = 0;
+    }
+};
+
+void writeStageStats(ostream& output, string stageName, StageStats& stage) {
+    output << "    \"" << stageName << "\": {\"seconds\": " << stage.seconds << ", \"trianglesIn\": " << stage.trianglesIn << ", \"trianglesOut\": " << stage.trianglesOut << "}," << endl;
+}
+
+bool writeStatsFile(string fileName, PipelineStats& stats, Config& config) {
+    ofstream output(fileName.c_str());
+    if(!output.is_open()) {
+        return false;
+    }
+    output << setprecision(9);
+
+    RasterCounters& raster = stats.rasterCounters;
+    double totalSeconds = stats.loading.seconds + stats.modeling.seconds + stats.viewing.seconds + stats.projection.seconds + stats.fused.seconds + stats.scanConversion.seconds + stats.pipelined.seconds + stats.shadows.seconds + stats.saving.seconds;
+
+    output << "{" << endl;
+    output << "  \"screenWidth\": " << config.screenWidth << "," << endl;
+    output << "  \"screenHeight\": " << config.screenHeight << "," << endl;
+    output << "  \"sampleCount\": " << config.sampleCount << "," << endl;
+    output << "  \"totalSeconds\": " << totalSeconds << "," << endl;
+    output << "  \"peakMemoryBytes\": " << getPeakMemoryBytes() << "," << endl;
+    output << "  \"stages\": {" << endl;
+
+    writeStageStats(output, "load", stats.loading);
+    if(stats.bPipelined) {
+        writeStageStats(output, "pipelined", stats.pipelined);
+    } else if(stats.bFused) {
+        writeStageStats(output, "fused", stats.fused);
+    } else {
+        writeStageStats(output, "modeling", stats.modeling);
+        writeStageStats(output, "view", stats.viewing);
+        writeStageStats(output, "projection", stats.projection);
+    }
+    if(!stats.bPipelined) {
+        writeStageStats(output, "scanConversion", stats.scanConversion);
+    }
+    if(stats.lightCount > 0) {
+        writeStageStats(output, "shadows", stats.shadows);
+    }
+
+    output << "    \"save\": {\"seconds\": " << stats.saving.seconds << "}" << endl;
+    output << "  }," << endl;
+
+    output << "  \"clipping\": {";
+    output << "\"trianglesRejected\": " << stats.clipCounters.trianglesRejected << ", ";
+    output << "\"trianglesClipped\": " << stats.clipCounters.trianglesClipped << ", ";
+    output << "\"trianglesClippedAway\": " << stats.clipCounters.trianglesClippedAway << "}," << endl;
+
+    if(stats.bStreamed) {
+        output << "  \"streaming\": {";
+        output << "\"binnedTriangles\": " << stats.binnedTriangles << ", ";
+        output << "\"spilledBytes\": " << stats.spilledBytes << "}," << endl;
+    }
+
+    if(stats.bPipelined) {
+        /* queues are named after stage they feed; mean occupancy near capacity means that stage holds pipeline back */
+        PipelineCounters& pipeline = stats.pipelineCounters;
+        const char* stageNames[PIPELINE_STAGE_COUNT] = {"modeling", "view", "projection", "scanConversion"};
+
+        output << "  \"pipeline\": {" << endl;
+        output << "    \"batchTriangles\": " << PIPELINE_BATCH_TRIANGLES << ", \"queueCapacity\": " << PIPELINE_QUEUE_CAPACITY << ", \"scanConversionBands\": " << pipeline.bandCount << "," << endl;
+        output << "    \"bottleneck\": \"" << stageNames[getPipelineBottleneck(pipeline)] << "\"," << endl;
+
+        output << "    \"busySeconds\": {";
+        for(int i=0; i<PIPELINE_STAGE_COUNT; i++) {
+            output << "\"" << stageNames[i] << "\": " << pipeline.busySeconds[i] << (i+1<PIPELINE_STAGE_COUNT? ", ": "},");
+        }
+        output << endl;
+
+        output << "    \"queues\": {" << endl;
+        for(int i=0; i+1<PIPELINE_STAGE_COUNT; i++) {
+            QueueCounters& queue = pipeline.queues[i];
+
+            output << "      \"" << stageNames[i+1] << "\": {";
+            output << "\"pushes\": " << queue.pushes << ", ";
+            output << "\"meanOccupancy\": " << queue.occupancySum/(double) max(queue.pushes, (uint64_t) 1) << ", ";
+            output << "\"fullWaits\": " << queue.fullWaits << ", ";
+            output << "\"emptyWaits\": " << queue.emptyWaits << "}" << (i+2<PIPELINE_STAGE_COUNT? ",": "") << endl;
+        }
+        output << "    }" << endl;
+        output << "  }," << endl;
+    }
+
+    /* overdraw: z-buffer writes per covered pixel, depth complexity: depth tests per covered pixel */
+    double coveredPixels = (double) max(stats.coveredPixels, (uint64_t) 1);
+
+    output << "  \"scanConversion\": {";
+    output << "\"trianglesSubmitted\": " << raster.trianglesSubmitted << ", ";
+    output << "\"trianglesCulledBack\": " << raster.trianglesCulledBack << ", ";
+    output << "\"trianglesCulledFront\": " << raster.trianglesCulledFront << ", ";
+    output << "\"trianglesCulledDegenerate\": " << raster.trianglesCulledDegenerate << ", ";
+    output << "\"trianglesCulledSmall\": " << raster.trianglesCulledSmall << ", ";
+    output << "\"trianglesOccluded\": " << raster.trianglesOccluded << ", ";
+    output << "\"scanlines\": " << raster.scanlines << ", ";
+    output << "\"segmentsOccluded\": " << raster.segmentsOccluded << ", ";
+    output << "\"pixelsTested\": " << raster.pixelsTested << ", ";
+    output << "\"pixelsWritten\": " << raster.pixelsWritten << ", ";
+    output << "\"pixelsCovered\": " << stats.coveredPixels << ", ";
+    output << "\"overdraw\": " << raster.pixelsWritten/coveredPixels << ", ";
+    output << "\"depthComplexity\": " << raster.pixelsTested/coveredPixels << "}" << endl;
+    output << "}" << endl;
+
+    output.close();
+    return !output.fail();
+}
+
+/*
+    depth dumps
+        - text: z-buffer.txt, depths of drawn pixels with 7 decimals, tab separated, one line per row
+        - binary: z-buffer.bin, DepthFileHeader followed by width*height float32 depths in row order
+          (rearLimitZ where nothing was drawn)
+        - compressed: z-buffer.zbin, same header & values as binary, but every float is XORed with the
+          previous one & only its nonzero low bytes are stored; byte counts of two consecutive values are
+          packed into one control byte (low nibble first) written ahead of their bytes
+*/
+
+#define DEPTH_DUMP_TEXT 0
+#define DEPTH_DUMP_BINARY 1
+#define DEPTH_DUMP_COMPRESSED 2
+#define DEPTH_DUMP_NONE 3
+
+#define DEPTH_FILE_MAGIC 0x4655425au  // "ZBUF"
+#define DEPTH_FILE_VERSION 1u
+#define DEPTH_DUMP_BUFFER_SIZE (1<<20)
+#define FIXED7_MAX_LENGTH 320  // "%.7f" of largest double & terminating null
+
+struct DepthFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t width;
+    uint32_t height;
+    float frontLimitZ;
+    float rearLimitZ;
+    uint32_t reserved;
+};
+
+inline char* formatFixed7(double value, char* output) {
+    /*
+        same text as ostream with fixed & setprecision(7); values whose scaled fraction lies too close to
+        a rounding tie to be decided in double precision (and huge or non-finite ones) go through snprintf
+    */
+    double magnitude = fabs(value)*1e7;
+    double fraction = magnitude - floor(magnitude);
+
+    if(!(magnitude < 1e9) || fabs(fraction - 0.5) < 1e-6) {
+        return output + snprintf(output, FIXED7_MAX_LENGTH, "%.7f", value);
+    }
+
+    uint64_t digits = (uint64_t) (magnitude + 0.5);
+    uint32_t integerPart = (uint32_t) (digits/10000000u);
+    uint32_t fractionPart = (uint32_t) (digits%10000000u);
+
+    if(signbit(value)) {
+        *output++ = '-';
+    }
+
+    char reversed[10];
+    int length = 0;
+    do {
+        reversed[length++] = (char) ('0' + integerPart%10);
+        integerPart /= 10;
+    } while(integerPart != 0);
+
+    while(length > 0) {
+        *output++ = reversed[--length];
+    }
+
+    *output++ = '.';
+    for(int i=6; i>=0; i--) {
+        output[i] = (char) ('0' + fractionPart%10);
+        fractionPart /= 10;
+    }
+    return output + 7;
+}
+
+template<class Depth>
+void writeDepthTextAs(ostream& output, FrameBuffer& frameBuffer, Config& config) {
+    /* formatting into one buffer, handed to stream in DEPTH_DUMP_BUFFER_SIZE chunks */
+    vector<char> buffer(DEPTH_DUMP_BUFFER_SIZE + FIXED7_MAX_LENGTH + 1);
+    size_t used = 0;
+
+    typename Depth::Value rearValue = Depth::encode(config.rearLimitZ, config);
+
+    for(int row=0; row<frameBuffer.getHeight(); row++) {
+        typename Depth::Value* depthRow = frameBuffer.getDepthRow<Depth>(row);
+
+        for(int column=0; column<frameBuffer.getWidth(); column++) {
+            if(depthRow[column] < rearValue) {
+                used = formatFixed7(Depth::decode(depthRow[column], config), &buffer[used]) - &buffer[0];
+                buffer[used++] = '\t';
+
+                if(used >= DEPTH_DUMP_BUFFER_SIZE) {
+                    output.write(&buffer[0], used);
+                    used = 0;
+                }
+            }
+        }
+        buffer[used++] = '\n';
+
+        /* rows without any value still fill buffer, one newline each */
+        if(used >= DEPTH_DUMP_BUFFER_SIZE) {
+            output.write(&buffer[0], used);
+            used = 0;
+        }
+    }
+    output.write(&buffer[0], used);
+}
+
+inline int countSignificantBytes(uint32_t value) {
+    int count = 0;
+    for(; value!=0; value>>=8) {
+        count++;
+    }
+    return count;
+}
+
+template<class Depth>
+void writeDepthBinaryAs(ostream& output, FrameBuffer& frameBuffer, Config& config, bool bCompressed) {
+    int width = frameBuffer.getWidth();
+
+    vector<float> values(width);
+    vector<unsigned char> buffer;
+    buffer.reserve(DEPTH_DUMP_BUFFER_SIZE + 16);
+
+    uint32_t previousBits = 0;
+    uint32_t pendingBits = 0;
+    bool bPending = false;
+
+    for(int row=0; row<frameBuffer.getHeight(); row++) {
+        typename Depth::Value* depthRow = frameBuffer.getDepthRow<Depth>(row);
+
+        for(int column=0; column<width; column++) {
+            values[column] = (float) Depth::decode(depthRow[column], config);
+        }
+
+        if(!bCompressed) {
+            output.write((const char*) &values[0], sizeof(float)*width);
+            continue;
+        }
+
+        for(int column=0; column<width; column++) {
+            uint32_t bits;
+            memcpy(&bits, &values[column], sizeof(bits));
+
+            uint32_t delta = bits ^ previousBits;
+            previousBits = bits;
+
+            if(!bPending) {
+                pendingBits = delta;
+                bPending = true;
+                continue;
+            }
+
+            int firstCount = countSignificantBytes(pendingBits), secondCount = countSignificantBytes(delta);
+
+            buffer.push_back((unsigned char) (firstCount | (secondCount<<4)));
+            for(int i=0; i<firstCount; i++) {
+                buffer.push_back((unsigned char) (pendingBits>>(8*i)));
+            }
+            for(int i=0; i<secondCount; i++) {
+                buffer.push_back((unsigned char) (delta>>(8*i)));
+            }
+            bPending = false;
+
+            if(buffer.size() >= DEPTH_DUMP_BUFFER_SIZE) {
+                output.write((const char*) &buffer[0], buffer.size());
+                buffer.clear();
+            }
+        }
+    }
+
+    if(bPending) {
+        /* odd value count: second byte count of last control byte is zero */
+        int firstCount = countSignificantBytes(pendingBits);
+
+        buffer.push_back((unsigned char) firstCount);
+        for(int i=0; i<firstCount; i++) {
+            buffer.push_back((unsigned char) (pendingBits>>(8*i)));
+        }
+    }
+    if(!buffer.empty()) {
+        output.write((const char*) &buffer[0], buffer.size());
+    }
+}
+
+bool writeDepthDump(string sceneDir, FrameBuffer& frameBuffer, Config& config, int depthDumpFormat) {
+    if(depthDumpFormat == DEPTH_DUMP_NONE) {
+        return true;
+    }
+
+    if(depthDumpFormat == DEPTH_DUMP_TEXT) {
+        ofstream output((sceneDir+"/z-buffer.txt").c_str());
+        if(!output.is_open()) {
+            return false;
+        }
+
+        if(frameBuffer.getDepthFormat() == DEPTH_FORMAT_DOUBLE) {
+            writeDepthTextAs<DoubleDepth>(output, frameBuffer, config);
+        } else if(frameBuffer.getDepthFormat() == DEPTH_FORMAT_FLOAT32) {
+            writeDepthTextAs<Float32Depth>(output, frameBuffer, config);
+        } else {
+            writeDepthTextAs<Unorm24Depth>(output, frameBuffer, config);
+        }
+        output.close();
+
+        return !output.fail();
+    }
+
+    bool bCompressed = depthDumpFormat == DEPTH_DUMP_COMPRESSED;
+
+    ofstream output((sceneDir+(bCompressed? "/z-buffer.zbin": "/z-buffer.bin")).c_str(), ios::out | ios::binary);
+    if(!output.is_open()) {
+        return false;
+    }
+
+    DepthFileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = DEPTH_FILE_MAGIC;
+    header.version = DEPTH_FILE_VERSION;
+    header.encoding = bCompressed? 1: 0;
+    header.width = frameBuffer.getWidth();
+    header.height = frameBuffer.getHeight();
+    header.frontLimitZ = (float) config.frontLimitZ;
+    header.rearLimitZ = (float) config.rearLimitZ;
+
+    output.write((const char*) &header, sizeof(header));
+
+    if(frameBuffer.getDepthFormat() == DEPTH_FORMAT_DOUBLE) {
+        writeDepthBinaryAs<DoubleDepth>(output, frameBuffer, config, bCompressed);
+    } else if(frameBuffer.getDepthFormat() == DEPTH_FORMAT_FLOAT32) {
+        writeDepthBinaryAs<Float32Depth>(output, frameBuffer, config, bCompressed);
+    } else {
+        writeDepthBinaryAs<Unorm24Depth>(output, frameBuffer, config, bCompressed);
+    }
+    output.close();
+
+    return !output.fail();
+}
+
+struct PipelineOptions {
+    bool bDumpStages;
+    bool bClipping;
+    bool bSeparateStages;
+    bool bStats;
+    bool bStream;
+    bool bPipelined;
+    bool bShadows;
+    int shadowMapSize;
+    int depthDumpFormat;
+    int imageFormat;
+    unsigned int seed;  // job i draws its random colors from seed + i
+    RasterOptions raster;
+
+    PipelineOptions() {
+        bDumpStages = false;
+        bClipping = true;
+        bSeparateStages = false;
+        bStats = false;
+        bStream = false;
+        bPipelined = false;
+        bShadows = false;
+        shadowMapSize = SHADOW_MAP_SIZE;
+        depthDumpFormat = DEPTH_DUMP_TEXT;
+        imageFormat = IMAGE_FORMAT_BMP;
+        seed = 0;
+    }
+};
+
+bool renderScene(Scene& scene, string sceneDir, PipelineOptions& options, int jobIndex, Config& config, FrameBuffer& frameBuffer, vector<Triangle>& triangles, PipelineStats& stats, chrono::steady_clock::time_point stageStart) {
+    /*
+        runs stages 1-4 of a loaded scene into frameBuffer, which is reallocated only if it has to grow;
+        side files (spill file, visibility.bin, lights.txt) & messages refer to sceneDir; random colors are
+        seeded with options.seed + jobIndex, so that they do not depend on other jobs
+    */
+    Camera camera = scene.camera;
+
+    if(options.raster.bVisibilityBuffer && config.sampleCount>1) {
+        cout << sceneDir << ": visibility buffer needs one sample per pixel" << endl;
+        return false;
+    }
+
+    /*
+        assigning random colors to triangles (before clipping, so that pieces of a triangle share its color);
+        when streaming or pipelined, stage 1 draws the same colors one triangle at a time instead
+    */
+    ColorGenerator generator(options.seed + (unsigned int) jobIndex);
+    vector<Color> colors((options.bStream || options.bPipelined)? 0: scene.triangleCount);
+
+    for(size_t i=0; i<colors.size(); i++) {
+        colors[i] = getRandomColor(generator);
+    }
+
+    Transformation viewTransformation;
+    viewTransformation.generateViewMatrix(Point(camera.eyeX, camera.eyeY, camera.eyeZ), Point(camera.lookX, camera.lookY, camera.lookZ), Point(camera.upX, camera.upY, camera.upZ));
+
+    Transformation projectionTransformation;
+    projectionTransformation.generateProjectionMatrix(camera.fovY, camera.aspectRatio, camera.near, camera.far);
+
+    TriangleBinner binner;
+
+    stats.loading.trianglesOut = scene.triangleCount;
+    stats.loading.seconds = getSecondsSince(stageStart);
+
+    if(options.bSeparateStages || options.bDumpStages) {
+        /* stage1: modeling transformation */
+        runModelingStage(scene, triangles);
+
+        stats.modeling.trianglesIn = scene.triangleCount;
+        stats.modeling.trianglesOut = triangles.size();
+        stats.modeling.seconds = getSecondsSince(stageStart);
+
+        if(options.bDumpStages) {
+            writeStageFile(sceneDir+"/stage1.txt", triangles);
+        }
+
+        /* stage2: view transformation */
+        transformTriangles(triangles, viewTransformation);
+
+        stats.viewing.trianglesIn = stats.viewing.trianglesOut = triangles.size();
+        stats.viewing.seconds = getSecondsSince(stageStart);
+
+        if(options.bDumpStages) {
+            writeStageFile(sceneDir+"/stage2.txt", triangles);
+        }
+
+        /* stage3: projection transformation & clipping */
+        for(uint32_t i=0; i<scene.triangleCount; i++) {
+            triangles[i].rgb = colors[i];
+        }
+        stats.projection.trianglesIn = triangles.size();
+        runProjectionStage(triangles, projectionTransformation, config, options.bClipping, stats.clipCounters);
+
+        stats.projection.trianglesOut = triangles.size();
+        stats.projection.seconds = getSecondsSince(stageStart);
+
+        if(options.bDumpStages) {
+            writeStageFile(sceneDir+"/stage3.txt", triangles);
+        }
+    } else if(!options.bPipelined) {
+        /* stages 1-3 fused: modeling, view & projection transformation, clipping (output binned chunk by chunk if streaming) */
+        if(options.bStream && !binner.open(sceneDir+"/"+STREAM_SPILL_FILE_NAME, config, options.raster, config.sampleCount)) {
+            cout << sceneDir << ": cannot create " << STREAM_SPILL_FILE_NAME << endl;
+            return false;
+        }
+
+        runFusedTransformStages(scene, viewTransformation, projectionTransformation, colors, generator, config, options.bClipping, triangles, stats.clipCounters, options.bStream? &binner: NULL);
+
+        if(options.bStream) {
+            binner.consume(triangles);
+            vector<Triangle>().swap(triangles);
+
+            if(binner.hasFailed()) {
+                cout << sceneDir << ": writing " << STREAM_SPILL_FILE_NAME << " failed" << endl;
+                return false;
+            }
+        }
+
+        stats.bFused = true;
+        stats.fused.trianglesIn = scene.triangleCount;
+        stats.fused.trianglesOut = options.bStream? binner.getTriangleCount(): triangles.size();
+        stats.fused.seconds = getSecondsSince(stageStart);
+    }
+
+    /* stage4: scan conversion using z-buffer algorithm */
+
+    /* initializing z-buffer & frame buffer */
+    frameBuffer.allocate(config.screenWidth, config.screenHeight, options.raster.depthFormat, config.sampleCount);
+    frameBuffer.setHierarchicalZ(options.raster.bHierarchicalZ);
+    frameBuffer.setCounters(options.bStats? &stats.rasterCounters: NULL);
+    frameBuffer.clear(config);
+    if(options.raster.bVisibilityBuffer) {
+        frameBuffer.fillColor(VISIBILITY_NONE);
+    }
+
+    /* applying procedure & resolving samples (if multisampled) or visible triangles into pixels */
+    if(options.bPipelined) {
+        /* stages 1-4 overlapped, scan converting batches as they leave stage 3 */
+        runPipelinedStages(scene, generator, viewTransformation, projectionTransformation, config, options.raster, options.bClipping, frameBuffer, stats.clipCounters, stats.pipelineCounters, stats.pipelined.trianglesOut);
+
+        stats.bPipelined = true;
+        stats.pipelined.trianglesIn = scene.triangleCount;
+    } else if(options.bStream) {
+        if(!runStreamedScanConversion(binner, config, options.raster, frameBuffer)) {
+            cout << sceneDir << ": reading " << STREAM_SPILL_FILE_NAME << " failed" << endl;
+            return false;
+        }
+
+        frameBuffer.addCounters(binner.getCounters());
+
+        stats.bStreamed = true;
+        stats.binnedTriangles = binner.getBinnedCount();
+        stats.spilledBytes = binner.getSpilledBytes();
+        binner.close();
+    } else {
+        runRasterStage(triangles, config, options.raster, frameBuffer);
+    }
+    frameBuffer.resolve();
+
+    if(options.raster.bVisibilityBuffer && !resolveVisibility(triangles, config, frameBuffer, sceneDir+"/visibility.bin")) {
+        return false;
+    }
+
+    if(options.bPipelined) {
+        stats.pipelined.seconds = getSecondsSince(stageStart);
+    } else {
+        stats.scanConversion.trianglesIn = stats.scanConversion.trianglesOut = options.bStream? stats.fused.trianglesOut: triangles.size();
+        stats.scanConversion.seconds = getSecondsSince(stageStart);
+    }
+
+    /* shadow pass: depth from every light of lights.txt (fused stages 1-3 & stage 4 per light), then shading */
+    if(options.bShadows) {
+        vector<Camera> lights;
+        if(!readLightsFile(sceneDir+"/"+SHADOW_LIGHTS_FILE_NAME, lights)) {
+            return false;
+        }
+
+        vector<ShadowMap> shadowMaps(lights.size());
+        vector<Triangle> lightTriangles;
+        ClipCounters lightClipCounters;
+
+        for(size_t i=0; i<lights.size(); i++) {
+            setUpShadowMap(lights[i], options.shadowMapSize, shadowMaps[i]);
+            runFusedTransformStages(scene, shadowMaps[i].viewTransformation, shadowMaps[i].projectionTransformation, colors, generator, shadowMaps[i].config, options.bClipping, lightTriangles, lightClipCounters, NULL);
+            renderShadowMap(lightTriangles, options.raster, shadowMaps[i]);
+
+            stats.shadows.trianglesIn += scene.triangleCount;
+            stats.shadows.trianglesOut += lightTriangles.size();
+        }
+        applyShadowMaps(config, frameBuffer, projectionTransformation*viewTransformation, shadowMaps);
+
+        stats.lightCount = (int) lights.size();
+        stats.shadows.seconds = getSecondsSince(stageStart);
+    }
+
+    return true;
+}
+
+bool renderTestCase(string sceneDir, PipelineOptions& options, int jobIndex, Config& config, FrameBuffer& frameBuffer, vector<Triangle>& triangles, PipelineStats& stats) {
+    /* runs stages 1-4 of one test case into frameBuffer, which is reallocated only if it has to grow */
+    chrono::steady_clock::time_point stageStart = chrono::steady_clock::now();
+
+    /* loading scene from scene.bin (if fresh) or scene.txt & reading values from config.txt */
+    Scene scene;
+
+    if(!loadScene(sceneDir, scene) || !readConfigFile(sceneDir+"/config.txt", config)) {
+        return false;
+    }
+    return renderScene(scene, sceneDir, options, jobIndex, config, frameBuffer, triangles, stats, stageStart);
+}
+
+bool writeImage(string fileName, int imageFormat, Config& config, FrameBuffer& frameBuffer) {
+    /* color plane rows are packed the way image_writer.hpp expects, so they are handed over as they are */
+    if(imageFormat == IMAGE_FORMAT_PNG) {
+        vector<const uint32_t*> rows(config.screenHeight);
+
+        for(int row=0; row<config.screenHeight; row++) {
+            rows[row] = frameBuffer.getColorRow(row);
+        }
+        return writePngFile(fileName, config.screenWidth, config.screenHeight, rows);
+    }
+
+    ImageFile image;
+    if(!image.open(fileName, config.screenWidth, config.screenHeight, imageFormat)) {
+        return false;
+    }
+
+    for(int row=0; row<config.screenHeight; row++) {
+        image.writeRow(row, frameBuffer.getColorRow(row));
+    }
+    return image.close();
+}
+
+bool encodeImage(int imageFormat, Config& config, FrameBuffer& frameBuffer, vector<unsigned char>& bytes) {
+    /* same encoding as writeImage(), kept in memory */
+    vector<const uint32_t*> rows(config.screenHeight);
+
+    for(int row=0; row<config.screenHeight; row++) {
+        rows[row] = frameBuffer.getColorRow(row);
+    }
+
+    if(imageFormat == IMAGE_FORMAT_PNG) {
+        return encodePngImage(config.screenWidth, config.screenHeight, rows, bytes);
+    }
+
+    ImageFile image;
+    image.openInMemory(config.screenWidth, config.screenHeight, imageFormat);
+
+    for(int row=0; row<config.screenHeight; row++) {
+        image.writeRow(row, rows[row]);
+    }
+    image.close();
+
+    bytes = image.getBytes();
+    return true;
+}
+
+bool saveOutputs(string sceneDir, Config& config, FrameBuffer& frameBuffer, PipelineStats& stats, PipelineOptions& options) {
+    /* writing out.bmp (or .ppm/.png), depth dump & (if asked to) stats.json of a rendered test case */
+    chrono::steady_clock::time_point stageStart = chrono::steady_clock::now();
+    int screenWidth = config.screenWidth, screenHeight = config.screenHeight;
+
+    string imageFileName = sceneDir+"/out"+getImageExtension(options.imageFormat);
+    future<bool> pendingImage;
+
+    /* PNG is encoded in background while depth dump is written; both only read frame buffer */
+    if(options.imageFormat == IMAGE_FORMAT_PNG) {
+        pendingImage = async(launch::async, [&]() {
+            return writeImage(imageFileName, options.imageFormat, config, frameBuffer);
+        });
+    } else if(!writeImage(imageFileName, options.imageFormat, config, frameBuffer)) {
+        return false;
+    }
+
+    if(!writeDepthDump(sceneDir, frameBuffer, config, options.depthDumpFormat)) {
+        return false;
+    }
+    if(pendingImage.valid() && !pendingImage.get()) {
+        return false;
+    }
+
+    if(options.bStats) {
+        stats.saving.seconds = getSecondsSince(stageStart);
+
+        for(int row=0; row<screenHeight; row++) {
+            for(int column=0; column<screenWidth; column++) {
+                stats.coveredPixels += frameBuffer.isDepthWritten(row, column, config)? 1: 0;
+            }
+        }
+
+        if(!writeStatsFile(sceneDir+"/stats.json", stats, config)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    batch mode: test case directories are rendered concurrently, one job per directory; every worker owns
+    two frame buffers, so that outputs of one job are written in background while next job is rasterized
+*/
+
+struct BatchSlot {
+    Config config;
+    FrameBuffer frameBuffer;
+    PipelineStats stats;
+    future<bool> pendingSave;
+};
+
+bool collectBatchSave(BatchSlot& slot) {
+    /* waits for slot's background save (if any); false if it failed */
+    return !slot.pendingSave.valid() || slot.pendingSave.get();
+}
+
+bool expandBatchPattern(string pattern, vector<string>& sceneDirs) {
+#ifndef _WIN32
+    glob_t matches;
+
+    if(glob(pattern.c_str(), GLOB_MARK, NULL, &matches) != 0) {
+        return false;
+    }
+    for(size_t i=0; i<matches.gl_pathc; i++) {
+        string path = matches.gl_pathv[i];
+
+        /* GLOB_MARK appends '/' to directories only */
+        if(!path.empty() && path[path.size()-1]=='/') {
+            sceneDirs.push_back(path.substr(0, path.size()-1));
+        }
+    }
+    globfree(&matches);
+#else
+    sceneDirs.push_back(pattern);
+#endif
+    return true;
+}
+
+bool readBatchList(string fileName, vector<string>& sceneDirs) {
+    /* one test case directory per line, blank lines are skipped */
+    ifstream input(fileName.c_str());
+    if(!input.is_open()) {
+        return false;
+    }
+
+    string line;
+    while(getline(input, line)) {
+        if(!line.empty()) {
+            sceneDirs.push_back(line);
+        }
+    }
+    input.close();
+
+    return true;
+}
+
+bool runBatch(vector<string>& sceneDirs, PipelineOptions& options, int jobCount) {
+    atomic<int> nextJob(0);
+    atomic<int> failedJobs(0);
+    int jobTotal = (int) sceneDirs.size();
+
+    auto worker = [&]() {
+        BatchSlot slots[2];
+        vector<Triangle> triangles;
+        int current = 0;
+
+        for(int job=nextJob++; job<jobTotal; job=nextJob++) {
+            BatchSlot& slot = slots[current];
+
+            /* slot's frame buffer is free again only once its previous outputs are written */
+            if(!collectBatchSave(slot)) {
+                failedJobs++;
+            }
+            slot.stats = PipelineStats();
+
+            if(!renderTestCase(sceneDirs[job], options, job, slot.config, slot.frameBuffer, triangles, slot.stats)) {
+                cout << sceneDirs[job] << ": rendering failed" << endl;
+                failedJobs++;
+                continue;
+            }
+
+            string sceneDir = sceneDirs[job];
+
+            slot.pendingSave = async(launch::async, [&slot, &options, sceneDir]() {
+                bool bSaved = saveOutputs(sceneDir, slot.config, slot.frameBuffer, slot.stats, options);
+
+                if(!bSaved) {
+                    cout << sceneDir << ": saving outputs failed" << endl;
+                }
+                return bSaved;
+            });
+            current = 1 - current;
+        }
+
+        for(int i=0; i<2; i++) {
+            if(!collectBatchSave(slots[i])) {
+                failedJobs++;
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for(int i=1; i<min(jobCount, jobTotal); i++) {
+        workers.push_back(thread(worker));
+    }
+    worker();
+
+    for(size_t i=0; i<workers.size(); i++) {
+        workers[i].join();
+    }
+
+    cout << jobTotal - failedJobs << " of " << jobTotal << " test cases rendered" << endl;
+    return failedJobs == 0;
+}
+
+/*
+    camera path animation: stage 1 runs once & its world space triangles stay resident, while every frame
+    of the path runs fused stages 2-3 & stage 4 only; a frame is written in background while next one is
+    rasterized into the other of two frame buffers
+*/
+
+struct CameraKeyframe {
+    int frame;
+    Camera camera;  // aspectRatio, near & far are taken from scene.txt
+};
+
+bool readCameraPath(string fileName, vector<CameraKeyframe>& keyframes) {
+    /* one keyframe per line: frame eyeX eyeY eyeZ lookX lookY lookZ upX upY upZ fovY; blank & '#' lines are skipped */
+    ifstream input(fileName.c_str());
+    if(!input.is_open()) {
+        cout << fileName << ": cannot read camera path" << endl;
+        return false;
+    }
+
+    string line;
+    while(getline(input, line)) {
+        if(line.find_first_not_of(" \t\r") == string::npos || line[line.find_first_not_of(" \t\r")] == '#') {
+            continue;
+        }
+
+        istringstream fields(line);
+        CameraKeyframe keyframe;
+        Camera& camera = keyframe.camera;
+
+        if(!(fields >> keyframe.frame >> camera.eyeX >> camera.eyeY >> camera.eyeZ >> camera.lookX >> camera.lookY >> camera.lookZ >> camera.upX >> camera.upY >> camera.upZ >> camera.fovY)) {
+            cout << fileName << ": invalid keyframe \"" << line << "\"" << endl;
+            return false;
+        }
+        if(!keyframes.empty() && keyframe.frame<=keyframes.back().frame) {
+            cout << fileName << ": keyframe numbers must increase" << endl;
+            return false;
+        }
+        keyframes.push_back(keyframe);
+    }
+    input.close();
+
+    if(keyframes.empty()) {
+        cout << fileName << ": camera path has no keyframe" << endl;
+        return false;
+    }
+    return true;
+}
+
+Camera interpolateCamera(vector<CameraKeyframe>& keyframes, int frame, Camera& sceneCamera) {
+    /* linear interpolation of eye, look, up & fovY between keyframes surrounding frame */
+    size_t k = 0;
+    while(k+2<keyframes.size() && keyframes[k+1].frame<frame) {
+        k++;
+    }
+
+    Camera camera = sceneCamera;
+    Camera& from = keyframes[k].camera;
+    Camera& to = keyframes[min(k+1, keyframes.size()-1)].camera;
+
+    double t = (k+1 < keyframes.size())? (frame - keyframes[k].frame)/(double) (keyframes[k+1].frame - keyframes[k].frame): 0.0;
+
+    camera.eyeX = from.eyeX + t*(to.eyeX - from.eyeX);
+    camera.eyeY = from.eyeY + t*(to.eyeY - from.eyeY);
+    camera.eyeZ = from.eyeZ + t*(to.eyeZ - from.eyeZ);
+    camera.lookX = from.lookX + t*(to.lookX - from.lookX);
+    camera.lookY = from.lookY + t*(to.lookY - from.lookY);
+    camera.lookZ = from.lookZ + t*(to.lookZ - from.lookZ);
+    camera.upX = from.upX + t*(to.upX - from.upX);
+    camera.upY = from.upY + t*(to.upY - from.upY);
+    camera.upZ = from.upZ + t*(to.upZ - from.upZ);
+    camera.fovY = from.fovY + t*(to.fovY - from.fovY);
+
+    return camera;
+}
+
+bool runCameraPath(string sceneDir, string pathFileName, PipelineOptions& options) {
+    Scene scene;
+    Config config;
+    vector<CameraKeyframe> keyframes;
+
+    if(!loadScene(sceneDir, scene) || !readConfigFile(sceneDir+"/config.txt", config) || !readCameraPath(pathFileName, keyframes)) {
+        return false;
+    }
+    if(options.raster.bVisibilityBuffer && config.sampleCount>1) {
+        cout << sceneDir << ": visibility buffer needs one sample per pixel" << endl;
+        return false;
+    }
+
+    /* stage1 once, colors are assigned once so that they stay put across frames */
+    vector<Triangle> worldTriangles;
+    runModelingStage(scene, worldTriangles);
+
+    ColorGenerator generator(options.seed);
+
+    for(size_t i=0; i<worldTriangles.size(); i++) {
+        worldTriangles[i].rgb = getRandomColor(generator);
+    }
+
+    /* lights stay put along the path, so their shadow maps are rendered once */
+    vector<Camera> lights;
+    if(options.bShadows && !readLightsFile(sceneDir+"/"+SHADOW_LIGHTS_FILE_NAME, lights)) {
+        return false;
+    }
+
+    vector<ShadowMap> shadowMaps(lights.size());
+
+    if(options.bShadows) {
+        vector<Triangle> lightTriangles;
+        ClipCounters lightClipCounters;
+
+        for(size_t i=0; i<lights.size(); i++) {
+            setUpShadowMap(lights[i], options.shadowMapSize, shadowMaps[i]);
+            runViewProjectionStages(worldTriangles, shadowMaps[i].viewTransformation, shadowMaps[i].projectionTransformation, shadowMaps[i].config, options.bClipping, lightTriangles, lightClipCounters);
+            renderShadowMap(lightTriangles, options.raster, shadowMaps[i]);
+        }
+    }
+
+    FrameBuffer frameBuffers[2];
+    future<bool> pendingSaves[2];
+    bool bFramesWritten = true;
+    vector<Triangle> triangles;
+    ClipCounters clipCounters;
+
+    int firstFrame = keyframes.front().frame, lastFrame = keyframes.back().frame;
+
+    for(int frame=firstFrame; frame<=lastFrame; frame++) {
+        int current = (frame - firstFrame)%2;
+        FrameBuffer& frameBuffer = frameBuffers[current];
+
+        /* stages 2-3 need no frame buffer, so they run before waiting for its previous frame to be written */
+        Camera camera = interpolateCamera(keyframes, frame, scene.camera);
+
+        Transformation viewTransformation;
+        viewTransformation.generateViewMatrix(Point(camera.eyeX, camera.eyeY, camera.eyeZ), Point(camera.lookX, camera.lookY, camera.lookZ), Point(camera.upX, camera.upY, camera.upZ));
+
+        Transformation projectionTransformation;
+        projectionTransformation.generateProjectionMatrix(camera.fovY, camera.aspectRatio, camera.near, camera.far);
+
+        runViewProjectionStages(worldTriangles, viewTransformation, projectionTransformation, config, options.bClipping, triangles, clipCounters);
+
+        if(pendingSaves[current].valid()) {
+            bFramesWritten = pendingSaves[current].get() && bFramesWritten;
+        }
+
+        frameBuffer.allocate(config.screenWidth, config.screenHeight, options.raster.depthFormat, config.sampleCount);
+        frameBuffer.setHierarchicalZ(options.raster.bHierarchicalZ);
+        frameBuffer.clear(config);
+        if(options.raster.bVisibilityBuffer) {
+            frameBuffer.fillColor(VISIBILITY_NONE);
+        }
+
+        runRasterStage(triangles, config, options.raster, frameBuffer);
+        frameBuffer.resolve();
+
+        /* frames get colors of visible triangles only, no visibility.bin */
+        if(options.raster.bVisibilityBuffer) {
+            resolveVisibility(triangles, config, frameBuffer, "");
+        }
+        if(!shadowMaps.empty()) {
+            applyShadowMaps(config, frameBuffer, projectionTransformation*viewTransformation, shadowMaps);
+        }
+
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "/frame-%04d", frame);
+        string framePath = sceneDir + fileName + getImageExtension(options.imageFormat);
+
+        pendingSaves[current] = async(launch::async, [&config, &frameBuffer, &options, framePath]() {
+            return writeImage(framePath, options.imageFormat, config, frameBuffer);
+        });
+    }
+
+    for(int i=0; i<2; i++) {
+        if(pendingSaves[i].valid()) {
+            bFramesWritten = pendingSaves[i].get() && bFramesWritten;
+        }
+    }
+
+    if(!bFramesWritten) {
+        cout << sceneDir << ": writing frames failed" << endl;
+        return false;
+    }
+
+    cout << lastFrame - firstFrame + 1 << " frames rendered" << endl;
+    return true;
+}
+
+/*
+    render server: jobs are read line by line from standard input or from connections to a UNIX socket &
+    rendered with the options given on the command line; one frame buffer, scan conversion worker pool &
+    the loaded scenes (with their config.txt) stay warm between jobs
+        - render DIR: renders test case directory DIR & writes its outputs there as usual,
+          reply: "ok DIR SECONDS" or "error DIR MESSAGE"
+        - inline: followed by scene.txt text up to & including its "end" line, then config.txt values on one
+          line; reply: "image WIDTH HEIGHT LENGTH" followed by LENGTH bytes of the image (--image-format)
+        - quit: stops the server; end of input closes the connection (or ends the server on standard input)
+    pipeline messages go to standard error while serving standard input, so that replies stay parseable
+*/
+
+#define SERVER_SCENE_CACHE_SIZE 16
+
+struct CachedScene {
+    Scene scene;
+    Config config;
+    string stamp;  // modification times of scene.txt, scene.bin & config.txt when loaded
+};
+
+struct ServerState {
+    PipelineOptions options;
+    FrameBuffer frameBuffer;
+    vector<Triangle> triangles;
+    map< string, unique_ptr<CachedScene> > scenes;
+    int jobCount;  // render jobs served so far, i.e. index of next one
+
+    ServerState() {
+        jobCount = 0;
+    }
+};
+
+string getSceneStamp(string sceneDir) {
+    const char* fileNames[3] = {"/scene.txt", "/scene.bin", "/config.txt"};
+    ostringstream stamp;
+
+    for(int i=0; i<3; i++) {
+        struct stat status;
+
+        if(stat((sceneDir+fileNames[i]).c_str(), &status) == 0) {
+            stamp << (long long) status.st_mtime << ":" << (long long) status.st_size << ";";
+        } else {
+            stamp << "-;";
+        }
+    }
+    return stamp.str();
+}
+
+CachedScene* findCachedScene(ServerState& state, string sceneDir) {
+    /* reloads scene & config whenever one of their files changed; whole cache is dropped when full */
+    string stamp = getSceneStamp(sceneDir);
+    map< string, unique_ptr<CachedScene> >::iterator found = state.scenes.find(sceneDir);
+
+    if(found!=state.scenes.end() && found->second->stamp==stamp) {
+        return found->second.get();
+    }
+
+    if(found != state.scenes.end()) {
+        state.scenes.erase(found);
+    } else if(state.scenes.size() >= SERVER_SCENE_CACHE_SIZE) {
+        state.scenes.clear();
+    }
+
+    unique_ptr<CachedScene> cached(new CachedScene());
+    if(!loadScene(sceneDir, cached->scene) || !readConfigFile(sceneDir+"/config.txt", cached->config)) {
+        return NULL;
+    }
+    cached->stamp = stamp;
+
+    CachedScene* scene = cached.get();
+    state.scenes[sceneDir] = move(cached);
+    return scene;
+}
+
+void serveRenderJob(string sceneDir, ServerState& state, ostream& output) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point stageStart = start;
+
+    CachedScene* cached = findCachedScene(state, sceneDir);
+    if(cached == NULL) {
+        output << "error " << sceneDir << " cannot load scene" << endl;
+        return;
+    }
+
+    Config config = cached->config;
+    PipelineStats stats;
+
+    if(!renderScene(cached->scene, sceneDir, state.options, state.jobCount++, config, state.frameBuffer, state.triangles, stats, stageStart) || !saveOutputs(sceneDir, config, state.frameBuffer, stats, state.options)) {
+        output << "error " << sceneDir << " rendering failed" << endl;
+        return;
+    }
+
+    output << "ok " << sceneDir << " " << getSecondsSince(start) << endl;
+}
+
+void serveInlineJob(istream& input, ServerState& state, ostream& output) {
+    chrono::steady_clock::time_point stageStart = chrono::steady_clock::now();
+
+    /* scene text runs up to its end command; side files of inline jobs go to the working directory */
+    string sceneText, line;
+    bool bEnded = false;
+
+    while(!bEnded && getline(input, line)) {
+        istringstream fields(line);
+        string command;
+
+        bEnded = (fields >> command) && command.compare("end")==0;
+        sceneText += line + "\n";
+    }
+
+    string configLine;
+    if(!bEnded || !getline(input, configLine)) {
+        output << "error inline incomplete payload" << endl;
+        return;
+    }
+
+    Scene scene;
+    Config config;
+    istringstream sceneInput(sceneText), configInput(configLine);
+    PipelineStats stats;
+    vector<unsigned char> bytes;
+
+    if(!parseScene(sceneInput, scene, ".") || !readConfig(configInput, config, "inline")) {
+        output << "error inline invalid payload" << endl;
+        return;
+    }
+    if(!renderScene(scene, ".", state.options, state.jobCount++, config, state.frameBuffer, state.triangles, stats, stageStart) || !encodeImage(state.options.imageFormat, config, state.frameBuffer, bytes)) {
+        output << "error inline rendering failed" << endl;
+        return;
+    }
+
+    output << "image " << config.screenWidth << " " << config.screenHeight << " " << bytes.size() << "\n";
+    output.write((const char*) &bytes[0], bytes.size());
+    output.flush();
+}
+
+bool runServer(istream& input, ostream& output, ServerState& state) {
+    /* serves jobs until end of input (returns true) or quit (returns false) */
+    string line;
+
+    while(getline(input, line)) {
+        istringstream fields(line);
+        string command;
+
+        if(!(fields >> command) || command[0]=='#') {
+            continue;
+        }
+
+        if(command.compare("render") == 0) {
+            string sceneDir;
+
+            if(fields >> sceneDir) {
+                serveRenderJob(sceneDir, state, output);
+            } else {
+                output << "error render missing directory" << endl;
+            }
+        } else if(command.compare("inline") == 0) {
+            serveInlineJob(input, state, output);
+        } else if(command.compare("quit") == 0) {
+            return false;
+        } else {
+            output << "error " << command << " unknown command" << endl;
+        }
+    }
+    return true;
+}
+
+#ifndef _WIN32
+/* stream buffer over a connected socket, so that runServer() reads & writes connections like standard streams */
+class SocketStreamBuffer: public streambuf {
+    int socketDescriptor;
+    char inputBuffer[4096];
+    char outputBuffer[4096];
+
+protected:
+    int underflow() {
+        if(gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        ssize_t length = read(socketDescriptor, inputBuffer, sizeof(inputBuffer));
+        if(length <= 0) {
+            return traits_type::eof();
+        }
+        setg(inputBuffer, inputBuffer, inputBuffer+length);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    int overflow(int character) {
+        if(sync() != 0) {
+            return traits_type::eof();
+        }
+        if(character != traits_type::eof()) {
+            *pptr() = (char) character;
+            pbump(1);
+        }
+        return traits_type::not_eof(character);
+    }
+
+    int sync() {
+        for(char* next=pbase(); next<pptr(); ) {
+            ssize_t length = write(socketDescriptor, next, pptr() - next);
+            if(length <= 0) {
+                return -1;
+            }
+            next += length;
+        }
+        setp(outputBuffer, outputBuffer+sizeof(outputBuffer));
+        return 0;
+    }
+
+public:
+    explicit SocketStreamBuffer(int socketDescriptor) {
+        this->socketDescriptor = socketDescriptor;
+        setg(inputBuffer, inputBuffer, inputBuffer);
+        setp(outputBuffer, outputBuffer+sizeof(outputBuffer));
+    }
+
+    ~SocketStreamBuffer() {
+        sync();
+    }
+};
+
+bool runSocketServer(string socketPath, ServerState& state) {
+    /* one connection at a time; a vanished client must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if(socketPath.size() >= sizeof(address.sun_path)) {
+        cout << socketPath << ": socket path too long" << endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    /* only a stale socket of an earlier server is replaced, never any other file */
+    struct stat status;
+    if(lstat(socketPath.c_str(), &status) == 0) {
+        if(!S_ISSOCK(status.st_mode)) {
+            cout << socketPath << ": exists and is not a socket" << endl;
+            return false;
+        }
+        unlink(socketPath.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(listener<0 || ::bind(listener, (sockaddr*) &address, sizeof(address))!=0 || listen(listener, 8)!=0) {
+        cout << socketPath << ": cannot listen on socket" << endl;
+        if(listener >= 0) {
+            close(listener);
+        }
+        return false;
+    }
+
+    for(bool bServing=true; bServing; ) {
+        int connection = accept(listener, NULL, NULL);
+        if(connection < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        {
+            SocketStreamBuffer buffer(connection);
+            istream input(&buffer);
+            ostream output(&buffer);
+
+            bServing = runServer(input, output, state);
+        }
+        close(connection);
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    return true;
+}
+#endif
+
+bool runRenderServer(string socketPath, PipelineOptions& options) {
+    ServerState state;
+    state.options = options;
+
+    WorkerPool workerPool(options.raster.threadCount);
+    state.options.raster.workerPool = &workerPool;
+
+    if(!socketPath.empty()) {
+#ifndef _WIN32
+        return runSocketServer(socketPath, state);
+#else
+        cout << "--serve-socket: UNIX sockets are not supported on this platform" << endl;
+        return false;
+#endif
+    }
+
+    /* replies own standard output, everything else printed meanwhile goes to standard error */
+    ostream output(cout.rdbuf());
+    streambuf* coutBuffer = cout.rdbuf(cerr.rdbuf());
+
+    runServer(cin, output, state);
+
+    cout.rdbuf(coutBuffer);
+    return true;
+}
+
+/*
+    benchmark: synthetic scenes are generated as scene.txt text and pushed through stages 1-4 separately,
+    every stage is run BENCHMARK_REPEAT times on a fresh copy of its input & timings are reported as JSON
+*/
+
+#define BENCHMARK_TRIANGLES 100000
+#define BENCHMARK_REPEAT 3
+#define BENCHMARK_SCREEN_WIDTH 1280
+#define BENCHMARK_SCREEN_HEIGHT 720
+#define BENCHMARK_HIERARCHY_DEPTH 64
+#define BENCHMARK_MESH_TRIANGLES 500
+
+struct BenchmarkOptions {
+    int triangleCount;
+    int repeat;
+    string sceneName;
+    string outputFileName;
+
+    BenchmarkOptions() {
+        triangleCount = BENCHMARK_TRIANGLES;
+        repeat = BENCHMARK_REPEAT;
+    }
+};
+
+double getRandomValue(double low, double high) {
+    return low + (high - low)*rand()/RAND_MAX;
+}
+
+void writeBenchmarkCamera(ostream& output) {
+    /* eye at distance 50 looking down -z, so that [-40, 40] in x & y is roughly on screen */
+    output << "0.0 0.0 50.0" << endl;
+    output << "0.0 0.0 0.0" << endl;
+    output << "0.0 1.0 0.0" << endl;
+    output << "80.0 " << (double) BENCHMARK_SCREEN_WIDTH/BENCHMARK_SCREEN_HEIGHT << " 1.0 100.0" << endl;
+}
+
+void writeBenchmarkTriangle(ostream& output, double cx, double cy, double cz, double size) {
+    output << "triangle" << endl;
+
+    for(int j=0; j<3; j++) {
+        output << cx + getRandomValue(-size, size) << " " << cy + getRandomValue(-size, size) << " " << cz + getRandomValue(-size, size) << endl;
+    }
+}
+
+void generateRandomScene(ostream& output, int triangleCount, double extent, double size) {
+    /* triangles of given size scattered over [-extent, extent] in x, y & z */
+    for(int i=0; i<triangleCount; i++) {
+        writeBenchmarkTriangle(output, getRandomValue(-extent, extent), getRandomValue(-extent, extent), getRandomValue(-extent, extent), size);
+    }
+}
+
+void generateHierarchyScene(ostream& output, int triangleCount) {
+    /* chains of BENCHMARK_HIERARCHY_DEPTH nested push-transform-triangle levels, unwound by as many pops */
+    for(int i=0; i<triangleCount; ) {
+        int depth = min(BENCHMARK_HIERARCHY_DEPTH, triangleCount - i);
+
+        output << "push" << endl;
+        output << "translate" << endl << getRandomValue(-30.0, 30.0) << " " << getRandomValue(-30.0, 30.0) << " 0.0" << endl;
+
+        for(int level=0; level<depth; level++, i++) {
+            output << "push" << endl;
+            output << "rotate" << endl << getRandomValue(-10.0, 10.0) << " 0.0 0.0 1.0" << endl;
+            output << "translate" << endl << "0.5 0.0 0.0" << endl;
+            output << "scale" << endl << "0.98 0.98 0.98" << endl;
+            writeBenchmarkTriangle(output, 0.0, 0.0, 0.0, 2.0);
+        }
+        for(int level=0; level<=depth; level++) {
+            output << "pop" << endl;
+        }
+    }
+}
+
+void generateInstancedScene(ostream& output, int triangleCount) {
+    /* one mesh defined once & instanced at random places until triangleCount is reached */
+    int meshTriangleCount = min(BENCHMARK_MESH_TRIANGLES, triangleCount);
+
+    output << "define mesh" << endl;
+    generateRandomScene(output, meshTriangleCount, 3.0, 1.0);
+    output << "enddefine" << endl;
+
+    for(int i=0; i<triangleCount/meshTriangleCount; i++) {
+        output << "push" << endl;
+        output << "translate" << endl << getRandomValue(-35.0, 35.0) << " " << getRandomValue(-35.0, 35.0) << " " << getRandomValue(-35.0, 35.0) << endl;
+        output << "rotate" << endl << getRandomValue(0.0, 360.0) << " " << getRandomValue(-1.0, 1.0) << " 1.0 " << getRandomValue(-1.0, 1.0) << endl;
+        output << "instance mesh" << endl;
+        output << "pop" << endl;
+    }
+}
+
+void generateOverdrawScene(ostream& output, int triangleCount) {
+    /* screen filling triangles stacked at random depths */
+    for(int i=0; i<triangleCount; i++) {
+        double z = getRandomValue(-40.0, 40.0);
+
+        output << "triangle" << endl;
+        output << "-200.0 -100.0 " << z << endl;
+        output << "200.0 -100.0 " << z << endl;
+        output << "0.0 200.0 " << z << endl;
+    }
+}
+
+bool generateBenchmarkScene(string sceneName, int triangleCount, string& sceneText, int& generatedCount) {
+    ostringstream output;
+    output << fixed << setprecision(4);
+
+    writeBenchmarkCamera(output);
+
+    if(sceneName.compare("random") == 0) {
+        generatedCount = triangleCount;
+        generateRandomScene(output, generatedCount, 40.0, 3.0);
+    } else if(sceneName.compare("hierarchy") == 0) {
+        generatedCount = triangleCount;
+        generateHierarchyScene(output, generatedCount);
+    } else if(sceneName.compare("large") == 0) {
+        /* every large triangle covers about a quarter of the screen */
+        generatedCount = max(1, triangleCount/100);
+        generateRandomScene(output, generatedCount, 40.0, 30.0);
+    } else if(sceneName.compare("tiny") == 0) {
+        /* smaller than a pixel */
+        generatedCount = triangleCount;
+        generateRandomScene(output, generatedCount, 40.0, 0.03);
+    } else if(sceneName.compare("instanced") == 0) {
+        generatedCount = triangleCount/min(BENCHMARK_MESH_TRIANGLES, triangleCount)*min(BENCHMARK_MESH_TRIANGLES, triangleCount);
+        generateInstancedScene(output, triangleCount);
+    } else if(sceneName.compare("overdraw") == 0) {
+        generatedCount = max(1, triangleCount/1000);
+        generateOverdrawScene(output, generatedCount);
+    } else {
+        return false;
+    }
+
+    output << "end" << endl;
+    sceneText = output.str();
+
+    return true;
+}
+
+struct StageTiming {
+    double bestSeconds;
+    double totalSeconds;
+    size_t trianglesIn;
+    size_t trianglesOut;
+
+    StageTiming() {
+        bestSeconds = INF;
+        totalSeconds = 0.0;
+        trianglesIn = trianglesOut = 0;
+    }
+
+    void add(chrono::steady_clock::time_point start) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        bestSeconds = min(bestSeconds, seconds);
+        totalSeconds += seconds;
+    }
+};
+
+void writeStageTiming(ostream& output, string stageName, StageTiming& timing, int repeat, bool bLast) {
+    output << "        \"" << stageName << "\": {";
+    output << "\"seconds\": " << timing.bestSeconds << ", ";
+    output << "\"meanSeconds\": " << timing.totalSeconds/repeat << ", ";
+    output << "\"trianglesIn\": " << timing.trianglesIn << ", ";
+    output << "\"trianglesOut\": " << timing.trianglesOut << ", ";
+    output << "\"trianglesPerSecond\": " << (timing.bestSeconds>0.0? timing.trianglesIn/timing.bestSeconds: 0.0) << "}";
+    output << (bLast? "": ",") << endl;
+}
+
+bool runBenchmarkScene(string sceneName, BenchmarkOptions& benchmarkOptions, RasterOptions& rasterOptions, bool bClipping, ostream& output, bool bLast) {
+    string sceneText;
+    int generatedCount;
+
+    /* same scene on every run */
+    srand(1605023);
+
+    if(!generateBenchmarkScene(sceneName, benchmarkOptions.triangleCount, sceneText, generatedCount)) {
+        cout << sceneName << ": invalid benchmark scene" << endl;
+        return false;
+    }
+
+    Config config;
+    config.screenWidth = BENCHMARK_SCREEN_WIDTH;
+    config.screenHeight = BENCHMARK_SCREEN_HEIGHT;
+    config.leftLimitX = config.bottomLimitY = -1.0;
+    config.frontLimitZ = -1.0;
+    config.rearLimitZ = 1.0;
+    config.sampleCount = 1;
+    setUpConfig(config);
+
+    int repeat = benchmarkOptions.repeat;
+    StageTiming parsing, modeling, viewing, projection, fused, scanConversion;
+
+    /* scene.txt parsing */
+    Scene scene;
+
+    for(int run=0; run<repeat; run++) {
+        Scene parsedScene;
+        istringstream input(sceneText);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(!parseScene(input, run==0? scene: parsedScene, "")) {
+            return false;
+        }
+        parsing.add(start);
+    }
+    parsing.trianglesIn = parsing.trianglesOut = scene.triangleCount;
+
+    Camera camera = scene.camera;
+
+    Transformation viewTransformation;
+    viewTransformation.generateViewMatrix(Point(camera.eyeX, camera.eyeY, camera.eyeZ), Point(camera.lookX, camera.lookY, camera.lookZ), Point(camera.upX, camera.upY, camera.upZ));
+
+    Transformation projectionTransformation;
+    projectionTransformation.generateProjectionMatrix(camera.fovY, camera.aspectRatio, camera.near, camera.far);
+
+    ColorGenerator generator(1605023);
+    vector<Color> colors(scene.triangleCount);
+
+    for(uint32_t i=0; i<scene.triangleCount; i++) {
+        colors[i] = getRandomColor(generator);
+    }
+
+    /* stage1 */
+    vector<Triangle> modeledTriangles;
+
+    for(int run=0; run<repeat; run++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        runModelingStage(scene, modeledTriangles);
+        modeling.add(start);
+    }
+    modeling.trianglesIn = scene.triangleCount;
+    modeling.trianglesOut = modeledTriangles.size();
+
+    /* stage2 */
+    vector<Triangle> viewedTriangles;
+
+    for(int run=0; run<repeat; run++) {
+        viewedTriangles = modeledTriangles;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        transformTriangles(viewedTriangles, viewTransformation);
+        viewing.add(start);
+    }
+    viewing.trianglesIn = modeledTriangles.size();
+    viewing.trianglesOut = viewedTriangles.size();
+
+    for(uint32_t i=0; i<scene.triangleCount; i++) {
+        viewedTriangles[i].rgb = colors[i];
+    }
+
+    /* stage3 */
+    vector<Triangle> projectedTriangles;
+    ClipCounters clipCounters;
+
+    for(int run=0; run<repeat; run++) {
+        projectedTriangles = viewedTriangles;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        runProjectionStage(projectedTriangles, projectionTransformation, config, bClipping, clipCounters);
+        projection.add(start);
+    }
+    projection.trianglesIn = viewedTriangles.size();
+    projection.trianglesOut = projectedTriangles.size();
+
+    /* stages 1-3 fused, as run by default */
+    vector<Triangle> fusedTriangles;
+
+    for(int run=0; run<repeat; run++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        runFusedTransformStages(scene, viewTransformation, projectionTransformation, colors, generator, config, bClipping, fusedTriangles, clipCounters, NULL);
+        fused.add(start);
+    }
+    fused.trianglesIn = scene.triangleCount;
+    fused.trianglesOut = fusedTriangles.size();
+
+    /* stage4 */
+    FrameBuffer frameBuffer;
+    frameBuffer.allocate(config.screenWidth, config.screenHeight, rasterOptions.depthFormat, config.sampleCount);
+    frameBuffer.setHierarchicalZ(rasterOptions.bHierarchicalZ);
+
+    vector<Triangle> rasterizedTriangles;
+
+    for(int run=0; run<repeat; run++) {
+        rasterizedTriangles = projectedTriangles;
+        frameBuffer.clear(config);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        runRasterStage(rasterizedTriangles, config, rasterOptions, frameBuffer);
+        scanConversion.add(start);
+    }
+    scanConversion.trianglesIn = scanConversion.trianglesOut = projectedTriangles.size();
+
+    output << "    {" << endl;
+    output << "      \"name\": \"" << sceneName << "\"," << endl;
+    output << "      \"triangles\": " << generatedCount << "," << endl;
+    output << "      \"matrices\": " << scene.matrixCount << "," << endl;
+    output << "      \"stages\": {" << endl;
+    writeStageTiming(output, "parse", parsing, repeat, false);
+    writeStageTiming(output, "modeling", modeling, repeat, false);
+    writeStageTiming(output, "view", viewing, repeat, false);
+    writeStageTiming(output, "projection", projection, repeat, false);
+    writeStageTiming(output, "fused", fused, repeat, false);
+    writeStageTiming(output, "scanConversion", scanConversion, repeat, true);
+    output << "      }" << endl;
+    output << "    }" << (bLast? "": ",") << endl;
+
+    return true;
+}
+
+bool runBenchmark(BenchmarkOptions& benchmarkOptions, RasterOptions& rasterOptions, bool bClipping) {
+    const char* sceneNames[] = {"random", "hierarchy", "large", "tiny", "instanced", "overdraw"};
+    int sceneCount = sizeof(sceneNames)/sizeof(sceneNames[0]);
+
+    vector<string> selectedSceneNames;
+    for(int i=0; i<sceneCount; i++) {
+        if(benchmarkOptions.sceneName.empty() || benchmarkOptions.sceneName.compare(sceneNames[i])==0) {
+            selectedSceneNames.push_back(sceneNames[i]);
+        }
+    }
+    if(selectedSceneNames.empty()) {
+        cout << benchmarkOptions.sceneName << ": invalid benchmark scene" << endl;
+        return false;
+    }
+
+    const char* rasterizerNames[] = {"scanline", "halfspace"};
+    const char* depthFormatNames[] = {"double", "float32", "unorm24"};
+
+    ostringstream output;
+    output << setprecision(9);
+
+    output << "{" << endl;
+    output << "  \"screenWidth\": " << BENCHMARK_SCREEN_WIDTH << "," << endl;
+    output << "  \"screenHeight\": " << BENCHMARK_SCREEN_HEIGHT << "," << endl;
+    output << "  \"repeat\": " << benchmarkOptions.repeat << "," << endl;
+    output << "  \"threads\": " << rasterOptions.threadCount << "," << endl;
+    output << "  \"tileSize\": " << rasterOptions.tileSize << "," << endl;
+    output << "  \"rasterizer\": \"" << rasterizerNames[rasterOptions.rasterizer] << "\"," << endl;
+    output << "  \"depthFormat\": \"" << depthFormatNames[rasterOptions.depthFormat] << "\"," << endl;
+    output << "  \"hierarchicalZ\": " << (rasterOptions.bHierarchicalZ? "true": "false") << "," << endl;
+    output << "  \"clipping\": " << (bClipping? "true": "false") << "," << endl;
+    output << "  \"scenes\": [" << endl;
+
+    for(size_t i=0; i<selectedSceneNames.size(); i++) {
+        if(!runBenchmarkScene(selectedSceneNames[i], benchmarkOptions, rasterOptions, bClipping, output, i+1==selectedSceneNames.size())) {
+            return false;
+        }
+    }
+
+    output << "  ]" << endl;
+    output << "}" << endl;
+
+    if(benchmarkOptions.outputFileName.empty()) {
+        cout << output.str();
+        return true;
+    }
+
+    ofstream outputFile(benchmarkOptions.outputFileName.c_str());
+    if(!outputFile.is_open()) {
+        cout << benchmarkOptions.outputFileName << ": cannot write benchmark results" << endl;
+        return false;
+    }
+    outputFile << output.str();
+    outputFile.close();
+
+    return !outputFile.fail();
+}
+
+int main(int argc, char** argv) {
+    /* setting test case directory name */
+    string testCaseDir = "1";
+
+    /* parsing command line options */
+    bool bCompileScene = false;
+    bool bBenchmark = false;
+    bool bThreadCountGiven = false;
+    int jobCount = (int) thread::hardware_concurrency();
+    vector<string> batchSceneDirs;
+    string cameraPathFileName;
+    bool bServe = false;
+    string serverSocketPath;
+    bool bSeedGiven = false;
+    unsigned int seed = 0;
+    PipelineOptions options;
+    RasterOptions& rasterOptions = options.raster;
+    BenchmarkOptions benchmarkOptions;
+
+    for(int i=1; i<argc; i++) {
+        string option = argv[i];
+
+        if(option.compare("--dump-stages") == 0) {
+            options.bDumpStages = true;
+        } else if(option.compare("--compile-scene") == 0) {
+            bCompileScene = true;
+        } else if(option.compare("--stats") == 0) {
+            options.bStats = true;
+        } else if(option.compare("--test-case")==0 && i+1<argc) {
+            testCaseDir = argv[++i];
+        } else if(option.compare("--batch")==0 && i+1<argc) {
+            string pattern = argv[++i];
+
+            if(!expandBatchPattern(pattern, batchSceneDirs)) {
+                cout << pattern << ": no test case directory matched" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if(option.compare("--batch-list")==0 && i+1<argc) {
+            string fileName = argv[++i];
+
+            if(!readBatchList(fileName, batchSceneDirs)) {
+                cout << fileName << ": cannot read batch list" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if(option.compare("--camera-path")==0 && i+1<argc) {
+            cameraPathFileName = argv[++i];
+        } else if(option.compare("--serve") == 0) {
+            bServe = true;
+        } else if(option.compare("--serve-socket")==0 && i+1<argc) {
+            bServe = true;
+            serverSocketPath = argv[++i];
+        } else if(option.compare("--seed")==0 && i+1<argc) {
+            bSeedGiven = true;
+            seed = (unsigned int) strtoul(argv[++i], NULL, 10);
+        } else if(option.compare("--jobs")==0 && i+1<argc) {
+            jobCount = atoi(argv[++i]);
+        } else if(option.compare("--benchmark") == 0) {
+            bBenchmark = true;
+        } else if(option.compare("--benchmark-triangles")==0 && i+1<argc) {
+            benchmarkOptions.triangleCount = atoi(argv[++i]);
+        } else if(option.compare("--benchmark-repeat")==0 && i+1<argc) {
+            benchmarkOptions.repeat = atoi(argv[++i]);
+        } else if(option.compare("--benchmark-scene")==0 && i+1<argc) {
+            benchmarkOptions.sceneName = argv[++i];
+        } else if(option.compare("--benchmark-output")==0 && i+1<argc) {
+            benchmarkOptions.outputFileName = argv[++i];
+        } else if(option.compare("--cull")==0 && i+1<argc) {
+            string cullFaces = argv[++i];
+
+            if(cullFaces.compare("none") == 0) {
+                rasterOptions.cullFaces = CULL_NONE;
+            } else if(cullFaces.compare("back") == 0) {
+                rasterOptions.cullFaces = CULL_BACK;
+            } else if(cullFaces.compare("front") == 0) {
+                rasterOptions.cullFaces = CULL_FRONT;
+            } else {
+                cout << cullFaces << ": invalid cull mode" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if(option.compare("--cull-degenerate") == 0) {
+            rasterOptions.bCullDegenerate = true;
+        } else if(option.compare("--cull-small") == 0) {
+            rasterOptions.bCullSmall = true;
+        } else if(option.compare("--no-hierarchical-z") == 0) {
+            rasterOptions.bHierarchicalZ = false;
+        } else if(option.compare("--visibility-buffer") == 0) {
+            rasterOptions.bVisibilityBuffer = true;
+        } else if(option.compare("--front-to-back") == 0) {
+            rasterOptions.bFrontToBack = true;
+        } else if(option.compare("--pipelined") == 0) {
+            options.bPipelined = true;
+        } else if(option.compare("--stream") == 0) {
+            options.bStream = true;
+        } else if(option.compare("--shadows") == 0) {
+            options.bShadows = true;
+        } else if(option.compare("--shadow-map-size")==0 && i+1<argc) {
+            options.shadowMapSize = atoi(argv[++i]);
+        } else if(option.compare("--separate-stages") == 0) {
+            options.bSeparateStages = true;
+        } else if(option.compare("--no-clipping") == 0) {
+            options.bClipping = false;
+        } else if(option.compare("--threads")==0 && i+1<argc) {
+            rasterOptions.threadCount = atoi(argv[++i]);
+            bThreadCountGiven = true;
+        } else if(option.compare("--tile-size")==0 && i+1<argc) {
+            rasterOptions.tileSize = atoi(argv[++i]);
+        } else if(option.compare("--rasterizer")==0 && i+1<argc) {
+            string rasterizer = argv[++i];
+
+            if(rasterizer.compare("scanline") == 0) {
+                rasterOptions.rasterizer = SCANLINE_RASTERIZER;
+            } else if(rasterizer.compare("halfspace") == 0) {
+                rasterOptions.rasterizer = HALF_SPACE_RASTERIZER;
+            } else if(rasterizer.compare("fixed") == 0) {
+                rasterOptions.rasterizer = FIXED_POINT_RASTERIZER;
+            } else {
+                cout << rasterizer << ": invalid rasterizer" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if(option.compare("--subpixel-bits")==0 && i+1<argc) {
+            rasterOptions.subpixelBits = atoi(argv[++i]);
+        } else if(option.compare("--depth-dump")==0 && i+1<argc) {
+            string depthDump = argv[++i];
+
+            if(depthDump.compare("text") == 0) {
+                options.depthDumpFormat = DEPTH_DUMP_TEXT;
+            } else if(depthDump.compare("binary") == 0) {
+                options.depthDumpFormat = DEPTH_DUMP_BINARY;
+            } else if(depthDump.compare("compressed") == 0) {
+                options.depthDumpFormat = DEPTH_DUMP_COMPRESSED;
+            } else if(depthDump.compare("none") == 0) {
+                options.depthDumpFormat = DEPTH_DUMP_NONE;
+            } else {
+                cout << depthDump << ": invalid depth dump format" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if(option.compare("--image-format")==0 && i+1<argc) {
+            string imageFormat = argv[++i];
+
+            if(imageFormat.compare("bmp") == 0) {
+                options.imageFormat = IMAGE_FORMAT_BMP;
+            } else if(imageFormat.compare("ppm") == 0) {
+                options.imageFormat = IMAGE_FORMAT_PPM;
+            } else if(imageFormat.compare("png") == 0) {
+                options.imageFormat = IMAGE_FORMAT_PNG;
+            } else {
+                cout << imageFormat << ": invalid image format" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if(option.compare("--depth-format")==0 && i+1<argc) {
+            string depthFormat = argv[++i];
+
+            if(depthFormat.compare("double") == 0) {
+                rasterOptions.depthFormat = DEPTH_FORMAT_DOUBLE;
+            } else if(depthFormat.compare("float32") == 0) {
+                rasterOptions.depthFormat = DEPTH_FORMAT_FLOAT32;
+            } else if(depthFormat.compare("unorm24") == 0) {
+                rasterOptions.depthFormat = DEPTH_FORMAT_UNORM24;
+            } else {
+                cout << depthFormat << ": invalid depth format" << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            cout << option << ": invalid option encountered" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(rasterOptions.threadCount < 1) {
+        rasterOptions.threadCount = 1;
+    }
+    if(rasterOptions.tileSize < 1) {
+        cout << rasterOptions.tileSize << ": invalid tile size" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(rasterOptions.subpixelBits<0 || rasterOptions.subpixelBits>MAX_SUBPIXEL_BITS) {
+        cout << rasterOptions.subpixelBits << ": invalid sub-pixel precision" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(options.shadowMapSize < 1) {
+        cout << options.shadowMapSize << ": invalid shadow map size" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(options.bStream && (options.bShadows || options.bSeparateStages || options.bDumpStages || rasterOptions.bVisibilityBuffer || rasterOptions.bFrontToBack || !cameraPathFileName.empty())) {
+        cout << "--stream: triangles are never resident together, so it cannot be combined with --shadows, --separate-stages, --dump-stages, --visibility-buffer, --front-to-back or --camera-path" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(options.bPipelined && (options.bStream || options.bSeparateStages || options.bDumpStages || rasterOptions.bVisibilityBuffer || rasterOptions.bFrontToBack || !cameraPathFileName.empty())) {
+        cout << "--pipelined: stages run concurrently over batches, so it cannot be combined with --stream, --separate-stages, --dump-stages, --visibility-buffer, --front-to-back or --camera-path" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(bServe && (!batchSceneDirs.empty() || !cameraPathFileName.empty())) {
+        cout << "--serve: test cases come from render jobs, so it cannot be combined with --batch, --batch-list or --camera-path" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /* running synthetic benchmark scenes instead of a test case if asked to */
+    if(bBenchmark) {
+        if(benchmarkOptions.triangleCount<1 || benchmarkOptions.repeat<1) {
+            cout << "benchmark triangle count & repeat must be positive" << endl;
+            exit(EXIT_FAILURE);
+        }
+        if(!runBenchmark(benchmarkOptions, rasterOptions, options.bClipping)) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    /* compiling scene.txt into scene.bin (of every batch directory) if asked to */
+    if(bCompileScene) {
+        if(batchSceneDirs.empty()) {
+            batchSceneDirs.push_back("./test-cases/"+testCaseDir);
+        }
+
+        for(size_t i=0; i<batchSceneDirs.size(); i++) {
+            Scene scene;
+
+            if(!parseSceneFile(batchSceneDirs[i]+"/scene.txt", scene) || !writeSceneBinary(batchSceneDirs[i]+"/scene.bin", scene)) {
+                cout << batchSceneDirs[i] << ": compiling scene failed" << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        return 0;
+    }
+
+    /* one seed for whole run; job i of a batch or server draws its random colors from seed + i */
+    options.seed = bSeedGiven? seed: (unsigned int) time(0);
+
+    /* rendering many test cases concurrently if asked to */
+    if(!batchSceneDirs.empty()) {
+        /* jobs already occupy all hardware threads, so each job scan converts serially unless told otherwise */
+        if(!bThreadCountGiven) {
+            rasterOptions.threadCount = 1;
+        }
+        if(!runBatch(batchSceneDirs, options, max(jobCount, 1))) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    /* serving render jobs until told to quit if asked to */
+    if(bServe) {
+        if(!runRenderServer(serverSocketPath, options)) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    string sceneDir = "./test-cases/"+testCaseDir;
+
+    /* rendering frames along a camera path if asked to */
+    if(!cameraPathFileName.empty()) {
+        if(!runCameraPath(sceneDir, cameraPathFileName, options)) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    /* rendering single test case */
+    FrameBuffer frameBuffer;
+    vector<Triangle> triangles;
+    Config config;
+    PipelineStats stats;
+
+    if(!renderTestCase(sceneDir, options, 0, config, frameBuffer, triangles, stats) || !saveOutputs(sceneDir, config, frameBuffer, stats, options)) {
+        exit(EXIT_FAILURE);
+    }
+
+    if(options.bPipelined) {
+        /* mean queue occupancy (out of capacity) in front of stages 2, 3 & 4 */
+        PipelineCounters& pipeline = stats.pipelineCounters;
+
+        cout << sceneDir << ": pipelined, queue occupancy" << fixed << setprecision(1);
+        for(int i=0; i+1<PIPELINE_STAGE_COUNT; i++) {
+            cout << " " << pipeline.queues[i].occupancySum/(double) max(pipeline.queues[i].pushes, (uint64_t) 1) << "/" << PIPELINE_QUEUE_CAPACITY;
+        }
+        cout << ", bottleneck stage " << getPipelineBottleneck(pipeline) + 1 << ", peak memory " << getPeakMemoryBytes()/1048576.0 << " MiB" << endl;
     }
-    delete[] zBuffer;
 
-    for(int i=0; i<screenHeight; i++) {
-        delete[] frameBuffer[i];
+    if(options.bStream) {
+        cout << sceneDir << ": " << stats.fused.trianglesOut << " triangles streamed, " << fixed << setprecision(1) << stats.spilledBytes/1048576.0 << " MiB spilled, peak memory " << getPeakMemoryBytes()/1048576.0 << " MiB" << endl;
     }
-    delete[] frameBuffer;
 
     return 0;
 }
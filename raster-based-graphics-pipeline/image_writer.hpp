@@ -0,0 +1,399 @@
+#ifndef IMAGE_WRITER_HPP
+#define IMAGE_WRITER_HPP
+
+#include<iostream>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<algorithm>
+#include<cstring>
+#include<cstdio>
+#include<stdint.h>
+
+#ifndef _WIN32
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<unistd.h>
+#endif
+
+#ifdef IMAGE_WRITER_ZLIB
+#include<zlib.h>
+#endif
+
+/*
+    image output shared by the raster pipeline & the ray tracer
+        - ImageFile writes 24-bit BMP or binary PPM (P6) files: the file is sized up front & every scanline
+          is written straight into place (memory-mapped on POSIX, buffered in memory on Windows); with
+          openInMemory() the encoded image is only kept in memory
+        - writePngFile() encodes an RGB PNG; image data is deflate-compressed when compiled with
+          -DIMAGE_WRITER_ZLIB (link with -lz) and kept in stored (uncompressed) deflate blocks otherwise;
+          encodePngImage() returns the encoded PNG instead
+
+    pixels are passed as packed 32-bit values: red | green<<8 | blue<<16 (upper byte ignored)
+*/
+
+#define IMAGE_FORMAT_BMP 0
+#define IMAGE_FORMAT_PPM 1
+#define IMAGE_FORMAT_PNG 2
+
+#define BMP_HEADER_SIZE 54
+#define PNG_STORED_BLOCK_SIZE 65535
+
+inline void putLittleEndian(unsigned char* output, uint32_t value, int byteCount) {
+    for(int i=0; i<byteCount; i++) {
+        output[i] = (unsigned char) ((value>>(8*i)) & 255u);
+    }
+}
+
+inline void putBigEndian(unsigned char* output, uint32_t value) {
+    for(int i=0; i<4; i++) {
+        output[i] = (unsigned char) ((value>>(8*(3 - i))) & 255u);
+    }
+}
+
+inline std::string getImageExtension(int imageFormat) {
+    if(imageFormat == IMAGE_FORMAT_PPM) {
+        return ".ppm";
+    } else if(imageFormat == IMAGE_FORMAT_PNG) {
+        return ".png";
+    }
+    return ".bmp";
+}
+
+class ImageFile {
+    int width;
+    int height;
+    int format;
+
+    size_t headerSize;
+    size_t rowSize;
+    size_t fileSize;
+    unsigned char* data;
+
+    bool bInMemory;
+    std::vector<unsigned char> storage;
+
+#ifndef _WIN32
+    int fileDescriptor;
+#else
+    std::string fileName;
+#endif
+
+    std::string getPpmHeader() const {
+        char header[64];
+        std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+        return header;
+    }
+
+    void setUpLayout(int width, int height, int format);
+    void writeHeader();
+
+public:
+    ImageFile() {
+        width = height = 0;
+        format = IMAGE_FORMAT_BMP;
+        headerSize = rowSize = fileSize = 0;
+        data = NULL;
+        bInMemory = false;
+#ifndef _WIN32
+        fileDescriptor = -1;
+#endif
+    }
+
+    ImageFile(const ImageFile&) = delete;
+    ImageFile& operator=(const ImageFile&) = delete;
+
+    bool open(std::string fileName, int width, int height, int format);
+    void openInMemory(int width, int height, int format);
+    void writeRow(int row, const uint32_t* pixels);
+    bool close();
+
+    /* encoded image of openInMemory(), valid after close() until next open */
+    const std::vector<unsigned char>& getBytes() const {
+        return storage;
+    }
+
+    ~ImageFile() {
+        close();
+    }
+};
+
+inline void ImageFile::writeHeader() {
+    if(format == IMAGE_FORMAT_PPM) {
+        std::memcpy(data, getPpmHeader().c_str(), headerSize);
+        return;
+    }
+
+    /* BITMAPFILEHEADER & BITMAPINFOHEADER of a bottom-up 24-bit image; fields left out stay zero */
+    data[0] = 'B';
+    data[1] = 'M';
+    putLittleEndian(data + 2, (uint32_t) fileSize, 4);
+    putLittleEndian(data + 10, BMP_HEADER_SIZE, 4);
+    putLittleEndian(data + 14, 40, 4);
+    putLittleEndian(data + 18, (uint32_t) width, 4);
+    putLittleEndian(data + 22, (uint32_t) height, 4);
+    putLittleEndian(data + 26, 1, 2);
+    putLittleEndian(data + 28, 24, 2);
+    putLittleEndian(data + 34, (uint32_t) (rowSize*height), 4);
+}
+
+inline void ImageFile::setUpLayout(int width, int height, int format) {
+    this->width = width;
+    this->height = height;
+    this->format = format;
+
+    if(format == IMAGE_FORMAT_PPM) {
+        headerSize = getPpmHeader().size();
+        rowSize = 3*(size_t) width;
+    } else {
+        headerSize = BMP_HEADER_SIZE;
+        rowSize = (3*(size_t) width + 3) & ~(size_t) 3;
+    }
+    fileSize = headerSize + rowSize*height;
+}
+
+inline bool ImageFile::open(std::string fileName, int width, int height, int format) {
+    close();
+
+    setUpLayout(width, height, format);
+    bInMemory = false;
+    std::vector<unsigned char>().swap(storage);
+
+#ifndef _WIN32
+    fileDescriptor = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fileDescriptor < 0) {
+        return false;
+    }
+
+    /* file is zero-filled up to its final size, so BMP row padding needs no writes */
+    if(ftruncate(fileDescriptor, (off_t) fileSize) != 0) {
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+        return false;
+    }
+
+    void* address = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if(address == MAP_FAILED) {
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+        return false;
+    }
+    data = (unsigned char*) address;
+#else
+    this->fileName = fileName;
+    storage.assign(fileSize, 0);
+    data = &storage[0];
+#endif
+
+    writeHeader();
+    return true;
+}
+
+inline void ImageFile::openInMemory(int width, int height, int format) {
+    close();
+
+    setUpLayout(width, height, format);
+    bInMemory = true;
+
+    storage.assign(fileSize, 0);
+    data = &storage[0];
+    writeHeader();
+}
+
+inline void ImageFile::writeRow(int row, const uint32_t* pixels) {
+    /* row 0 is the top row; BMP stores rows bottom-up as BGR, PPM top-down as RGB */
+    if(format == IMAGE_FORMAT_PPM) {
+        unsigned char* output = data + headerSize + row*rowSize;
+
+        for(int column=0; column<width; column++) {
+            output[3*column] = (unsigned char) (pixels[column] & 255u);
+            output[3*column + 1] = (unsigned char) ((pixels[column]>>8) & 255u);
+            output[3*column + 2] = (unsigned char) ((pixels[column]>>16) & 255u);
+        }
+        return;
+    }
+
+    unsigned char* output = data + headerSize + (height - 1 - row)*rowSize;
+
+    for(int column=0; column<width; column++) {
+        output[3*column] = (unsigned char) ((pixels[column]>>16) & 255u);
+        output[3*column + 1] = (unsigned char) ((pixels[column]>>8) & 255u);
+        output[3*column + 2] = (unsigned char) (pixels[column] & 255u);
+    }
+}
+
+inline bool ImageFile::close() {
+    if(data == NULL) {
+        return true;
+    }
+
+    if(bInMemory) {
+        data = NULL;
+        return true;
+    }
+
+    bool bWritten = true;
+
+#ifndef _WIN32
+    bWritten = munmap(data, fileSize) == 0;
+    bWritten = (::close(fileDescriptor) == 0) && bWritten;
+    fileDescriptor = -1;
+#else
+    std::ofstream output(fileName.c_str(), std::ios::out | std::ios::binary);
+    output.write((const char*) data, fileSize);
+    output.close();
+
+    bWritten = !output.fail();
+    std::vector<unsigned char>().swap(storage);
+#endif
+
+    data = NULL;
+    return bWritten;
+}
+
+/* PNG encoder */
+
+inline std::vector<uint32_t> buildPngCrcTable() {
+    std::vector<uint32_t> table(256);
+
+    for(uint32_t n=0; n<256; n++) {
+        uint32_t c = n;
+        for(int k=0; k<8; k++) {
+            c = (c & 1u)? 0xedb88320u ^ (c>>1): c>>1;
+        }
+        table[n] = c;
+    }
+    return table;
+}
+
+inline uint32_t updatePngCrc(uint32_t crc, const unsigned char* bytes, size_t length) {
+#ifdef IMAGE_WRITER_ZLIB
+    return (uint32_t) crc32(crc, bytes, (uInt) length);
+#else
+    /* initialized once even when encoders run concurrently */
+    static const std::vector<uint32_t> table = buildPngCrcTable();
+
+    crc = ~crc;
+    for(size_t i=0; i<length; i++) {
+        crc = table[(crc ^ bytes[i]) & 255u] ^ (crc>>8);
+    }
+    return ~crc;
+#endif
+}
+
+inline void appendPngChunk(std::vector<unsigned char>& output, const char* type, const unsigned char* chunkData, size_t length) {
+    unsigned char field[4];
+
+    putBigEndian(field, (uint32_t) length);
+    output.insert(output.end(), field, field+4);
+
+    size_t typeOffset = output.size();
+    output.insert(output.end(), type, type+4);
+    output.insert(output.end(), chunkData, chunkData+length);
+
+    putBigEndian(field, updatePngCrc(0, &output[typeOffset], length + 4));
+    output.insert(output.end(), field, field+4);
+}
+
+inline bool deflatePngData(std::vector<unsigned char>& raw, std::vector<unsigned char>& compressed) {
+#ifdef IMAGE_WRITER_ZLIB
+    uLongf length = compressBound((uLong) raw.size());
+    compressed.resize(length);
+
+    if(compress2(&compressed[0], &length, &raw[0], (uLong) raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return false;
+    }
+    compressed.resize(length);
+#else
+    /* zlib stream of stored blocks: 2 byte header, blocks of up to 65535 bytes & adler-32 of raw data */
+    compressed.clear();
+    compressed.reserve(raw.size() + raw.size()/PNG_STORED_BLOCK_SIZE*5 + 16);
+    compressed.push_back(0x78);
+    compressed.push_back(0x01);
+
+    uint32_t a = 1, b = 0;
+
+    for(size_t offset=0; offset<raw.size(); offset+=PNG_STORED_BLOCK_SIZE) {
+        size_t length = std::min((size_t) PNG_STORED_BLOCK_SIZE, raw.size() - offset);
+        unsigned char blockHeader[5];
+
+        blockHeader[0] = (offset + length >= raw.size())? 1: 0;
+        putLittleEndian(blockHeader + 1, (uint32_t) length, 2);
+        putLittleEndian(blockHeader + 3, (uint32_t) (~length & 0xffffu), 2);
+
+        compressed.insert(compressed.end(), blockHeader, blockHeader+5);
+        compressed.insert(compressed.end(), raw.begin()+offset, raw.begin()+offset+length);
+
+        /* sums stay below 2^32 for 5552 bytes, so modulo is taken once per run of that many */
+        for(size_t i=offset; i<offset+length; ) {
+            size_t runEnd = std::min(offset + length, i + 5552);
+
+            for(; i<runEnd; i++) {
+                a += raw[i];
+                b += a;
+            }
+            a %= 65521u;
+            b %= 65521u;
+        }
+    }
+
+    unsigned char adler[4];
+    putBigEndian(adler, (b<<16) | a);
+    compressed.insert(compressed.end(), adler, adler+4);
+#endif
+    return true;
+}
+
+inline bool encodePngImage(int width, int height, std::vector<const uint32_t*>& rows, std::vector<unsigned char>& file) {
+    /* rows[row] points at packed pixels of row (top row first) */
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+    std::vector<unsigned char> raw((3*(size_t) width + 1)*height);
+
+    for(int row=0; row<height; row++) {
+        unsigned char* output = &raw[row*(3*(size_t) width + 1)];
+        *output++ = 0;  // filter type: none
+
+        for(int column=0; column<width; column++) {
+            output[3*column] = (unsigned char) (rows[row][column] & 255u);
+            output[3*column + 1] = (unsigned char) ((rows[row][column]>>8) & 255u);
+            output[3*column + 2] = (unsigned char) ((rows[row][column]>>16) & 255u);
+        }
+    }
+
+    std::vector<unsigned char> compressed;
+    if(!deflatePngData(raw, compressed)) {
+        return false;
+    }
+
+    /* IHDR: width, height, bit depth 8, color type 2 (RGB), deflate, adaptive filtering, no interlace */
+    unsigned char header[13] = {0};
+    putBigEndian(header, (uint32_t) width);
+    putBigEndian(header + 4, (uint32_t) height);
+    header[8] = 8;
+    header[9] = 2;
+
+    file.assign(signature, signature+8);
+    appendPngChunk(file, "IHDR", header, sizeof(header));
+    appendPngChunk(file, "IDAT", compressed.empty()? NULL: &compressed[0], compressed.size());
+    appendPngChunk(file, "IEND", NULL, 0);
+    return true;
+}
+
+inline bool writePngFile(std::string fileName, int width, int height, std::vector<const uint32_t*>& rows) {
+    std::vector<unsigned char> file;
+    if(!encodePngImage(width, height, rows, file)) {
+        return false;
+    }
+
+    std::ofstream output(fileName.c_str(), std::ios::out | std::ios::binary);
+    if(!output.is_open()) {
+        return false;
+    }
+    output.write((const char*) &file[0], file.size());
+    output.close();
+
+    return !output.fail();
+}
+
+#endif
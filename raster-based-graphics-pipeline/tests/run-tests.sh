@@ -0,0 +1,357 @@
+#!/bin/bash
+# regression checks of 1605023.cpp on generated scenes; run from anywhere, exits nonzero on failure
+# usage: tests/run-tests.sh [CXX flags...], e.g. -fsanitize=undefined -fno-sanitize-recover=undefined
+
+PROGRAM_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+CXX="${CXX:-g++}"
+# library assertions turn out of range buffer indexing into aborts
+if ! "$CXX" -std=c++11 -O2 -Wall -D_GLIBCXX_ASSERTIONS "$@" -o "$WORK_DIR/pipeline" "$PROGRAM_DIR/1605023.cpp" -lpthread; then
+    echo "build failed"
+    exit 1
+fi
+
+FAILURES=0
+
+pass() {
+    echo "ok: $1"
+}
+
+fail() {
+    echo "FAILED: $1"
+    FAILURES=$((FAILURES + 1))
+}
+
+render() {
+    # render test case $1 of work directory with remaining arguments as options
+    local testCase="$1"
+    shift
+    (cd "$WORK_DIR" && ./pipeline --test-case "$testCase" "$@" > "$WORK_DIR/$testCase.log" 2>&1)
+}
+
+generate_random_scene() {
+    # scene $1 of $2 random overlapping triangles at varied depths & slopes, fixed seed
+    mkdir -p "$WORK_DIR/test-cases/$1"
+    awk -v count="$2" 'BEGIN {
+        srand(7);
+        print "0.0 0.0 50.0"; print "0.0 0.0 0.0"; print "0.0 1.0 0.0"; print "60.0 1.0 1.0 200.0";
+        for(i=0; i<count; i++) {
+            cx = 50*rand() - 25; cy = 50*rand() - 25; cz = 50*rand() - 25;
+            print "triangle";
+            for(k=0; k<3; k++) {
+                printf "%.4f %.4f %.4f\n", cx + 12*rand() - 6, cy + 12*rand() - 6, cz + 20*rand() - 10;
+            }
+        }
+        print "end";
+    }' > "$WORK_DIR/test-cases/$1/scene.txt"
+    printf '500 500\n-1\n-1\n-1 1\n' > "$WORK_DIR/test-cases/$1/config.txt"
+}
+
+same_files() {
+    cmp -s "$1" "$2"
+}
+
+# hierarchical z must never change output, whichever rasterizer & thread count is used
+test_hierarchical_z_output() {
+    generate_random_scene hiz 4000
+    local dir="$WORK_DIR/test-cases/hiz"
+
+    for options in "" "--rasterizer halfspace" "--rasterizer fixed" "--threads 4"; do
+        render hiz --seed 1 $options --no-hierarchical-z || { fail "hierarchical z ($options): render failed"; continue; }
+        cp "$dir/out.bmp" "$WORK_DIR/reference.bmp"
+        cp "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"
+
+        render hiz --seed 1 $options || { fail "hierarchical z ($options): render failed"; continue; }
+
+        if same_files "$dir/out.bmp" "$WORK_DIR/reference.bmp" && same_files "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"; then
+            pass "hierarchical z on & off give identical out.bmp & z-buffer.txt ($options)"
+        else
+            fail "hierarchical z on & off differ ($options)"
+        fi
+    done
+}
+
+# streaming through tile bins & the spill file must give the resident path's output
+test_stream_output() {
+    generate_random_scene stream 4000
+    local dir="$WORK_DIR/test-cases/stream"
+
+    for options in "--threads 1" "--threads 4" "--threads 4 --tile-size 128"; do
+        render stream --seed 1 $options || { fail "streaming ($options): render failed"; continue; }
+        cp "$dir/out.bmp" "$WORK_DIR/reference.bmp"
+        cp "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"
+
+        render stream --seed 1 $options --stream --stats || { fail "streaming ($options): render failed"; continue; }
+
+        if [ "$(stats_value "$dir/stats.json" spilledBytes streaming)" == "0" ]; then
+            fail "streaming ($options) spilled nothing"
+        elif same_files "$dir/out.bmp" "$WORK_DIR/reference.bmp" && same_files "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"; then
+            pass "streamed & resident renders give identical out.bmp & z-buffer.txt ($options)"
+        else
+            fail "streamed & resident renders differ ($options)"
+        fi
+    done
+}
+
+# pipelined stages must give --separate-stages output, whatever the number of stage 4 bands
+test_pipelined_output() {
+    generate_random_scene pipelined 4000
+    local dir="$WORK_DIR/test-cases/pipelined"
+
+    render pipelined --seed 1 --separate-stages || { fail "pipelined: reference render failed"; return; }
+    cp "$dir/out.bmp" "$WORK_DIR/reference.bmp"
+    cp "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"
+
+    for threads in 1 2 4 7; do
+        render pipelined --seed 1 --pipelined --threads $threads || { fail "pipelined (--threads $threads): render failed"; continue; }
+
+        if same_files "$dir/out.bmp" "$WORK_DIR/reference.bmp" && same_files "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"; then
+            pass "pipelined render with --threads $threads matches --separate-stages"
+        else
+            fail "pipelined render with --threads $threads differs from --separate-stages"
+        fi
+    done
+}
+
+# multisampled output must not depend on how stage 4 is split into tiles or bands
+test_multisample_output() {
+    generate_random_scene msaa 4000
+    local dir="$WORK_DIR/test-cases/msaa"
+
+    for samples in 2 4 8; do
+        printf '500 500\n-1\n-1\n-1 1\n%s\n' $samples > "$dir/config.txt"
+
+        render msaa --seed 1 --threads 1 || { fail "multisampling ($samples samples): render failed"; continue; }
+        cp "$dir/out.bmp" "$WORK_DIR/reference.bmp"
+        cp "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"
+
+        for options in "--threads 4" "--threads 4 --tile-size 16" "--threads 3 --pipelined"; do
+            render msaa --seed 1 $options || { fail "multisampling ($samples samples, $options): render failed"; continue; }
+
+            if same_files "$dir/out.bmp" "$WORK_DIR/reference.bmp" && same_files "$dir/z-buffer.txt" "$WORK_DIR/reference.txt"; then
+                pass "$samples sample render with $options matches --threads 1"
+            else
+                fail "$samples sample render with $options differs from --threads 1"
+            fi
+        done
+    done
+}
+
+# rows without any depth value must still flush z-buffer.txt buffer, one newline per row
+test_tall_empty_depth_dump() {
+    local dir="$WORK_DIR/test-cases/tall"
+    mkdir -p "$dir"
+    printf '0.0 0.0 50.0\n0.0 0.0 0.0\n0.0 1.0 0.0\n60.0 1.0 1.0 200.0\nend\n' > "$dir/scene.txt"
+    printf '1 1100000\n-1\n-1\n-1 1\n' > "$dir/config.txt"
+
+    if ! render tall; then
+        fail "tall empty frame: render failed: $(tail -1 "$WORK_DIR/tall.log")"
+    elif [ "$(wc -c < "$dir/z-buffer.txt")" -ne 1100000 ] || [ -n "$(tr -d '\n' < "$dir/z-buffer.txt")" ]; then
+        fail "tall empty frame: z-buffer.txt is not one empty line per row"
+    else
+        pass "tall empty frame writes one empty z-buffer.txt line per row"
+    fi
+}
+
+# concurrent batch jobs draw random colors from seed + job index, never from a shared generator
+test_batch_seeds() {
+    generate_random_scene batch1 1500
+    for job in 2 3 4 5 6; do
+        cp -r "$WORK_DIR/test-cases/batch1" "$WORK_DIR/test-cases/batch$job"
+    done
+
+    if ! (cd "$WORK_DIR" && ./pipeline --batch 'test-cases/batch*' --seed 9 --jobs 3 > "$WORK_DIR/batch.log" 2>&1); then
+        fail "seeded batch: rendering failed"
+        return
+    fi
+
+    for job in 1 2 3 4 5 6; do
+        cp "$WORK_DIR/test-cases/batch$job/out.bmp" "$WORK_DIR/batch$job.bmp"
+        render "batch$job" --seed $((8 + job)) || { fail "seeded batch: render of batch$job failed"; continue; }
+
+        if same_files "$WORK_DIR/test-cases/batch$job/out.bmp" "$WORK_DIR/batch$job.bmp"; then
+            pass "batch job $job with --seed 9 matches single render with --seed $((8 + job))"
+        else
+            fail "batch job $job with --seed 9 differs from single render with --seed $((8 + job))"
+        fi
+    done
+}
+
+stats_value() {
+    # first integer value of key $2 inside object "$3" of stats.json $1
+    grep "\"$3\"" "$1" | head -1 | sed -n "s/.*\"$2\": \([0-9]*\).*/\1/p"
+}
+
+# a corrupt scene.bin must leave scene untouched, so that falling back to scene.txt loads the scene once
+test_corrupt_scene_binary_fallback() {
+    generate_random_scene corrupt 3000
+    local dir="$WORK_DIR/test-cases/corrupt"
+
+    render corrupt --stats || { fail "corrupt scene.bin: render of scene.txt failed"; return; }
+    local expected="$(stats_value "$dir/stats.json" trianglesIn fused)"
+
+    render corrupt --compile-scene || { fail "corrupt scene.bin: compiling scene failed"; return; }
+
+    # without imported meshes the last 20 bytes are the last draw record; its matrix index is at byte 8
+    local length=$(wc -c < "$dir/scene.bin")
+    printf '\377\377\377\377' | dd of="$dir/scene.bin" bs=1 seek=$((length - 12)) conv=notrunc 2>/dev/null
+
+    render corrupt --stats || { fail "corrupt scene.bin: fallback render failed"; return; }
+    local actual="$(stats_value "$dir/stats.json" trianglesIn fused)"
+
+    if ! grep -q "corrupt scene binary" "$WORK_DIR/corrupt.log"; then
+        fail "corrupt scene.bin was not detected"
+    elif [ -z "$expected" ] || [ "$expected" != "$actual" ]; then
+        fail "corrupt scene.bin fallback loads $actual triangles instead of $expected"
+    else
+        pass "corrupt scene.bin falls back to scene.txt with $actual triangles"
+    fi
+}
+
+# drawn triangle count must not wrap around 32 bits: 65537 instances of 65536 triangles are rejected
+test_triangle_count_overflow() {
+    local dir="$WORK_DIR/test-cases/overflow"
+    mkdir -p "$dir"
+    awk 'BEGIN {
+        print "0.0 0.0 50.0"; print "0.0 0.0 0.0"; print "0.0 1.0 0.0"; print "60.0 1.0 1.0 200.0";
+        print "define quad";
+        for(i=0; i<65536; i++) {
+            print "triangle"; print "0 0 0"; print "1 0 0"; print "0 1 0";
+        }
+        print "enddefine";
+        for(i=0; i<65537; i++) {
+            print "instance quad";
+        }
+        print "end";
+    }' > "$dir/scene.txt"
+    printf '500 500\n-1\n-1\n-1 1\n' > "$dir/config.txt"
+
+    if render overflow; then
+        fail "scene of 2^32 triangles was accepted"
+    elif grep -q "scene draws more than 4294967295 triangles" "$WORK_DIR/overflow.log"; then
+        pass "scene of 2^32 triangles rejected"
+    else
+        fail "scene of 2^32 triangles: $(tail -1 "$WORK_DIR/overflow.log")"
+    fi
+}
+
+# --serve-socket may replace a stale socket only, never delete another file at its path
+test_socket_path_kept() {
+    echo "not a socket" > "$WORK_DIR/socket-path"
+
+    if (cd "$WORK_DIR" && ./pipeline --serve-socket socket-path > "$WORK_DIR/socket.log" 2>&1); then
+        fail "--serve-socket on a regular file did not fail"
+    elif [ "$(cat "$WORK_DIR/socket-path" 2>/dev/null)" != "not a socket" ]; then
+        fail "--serve-socket deleted a regular file"
+    else
+        pass "--serve-socket refuses to replace a regular file"
+    fi
+}
+
+# triangles are counted & culled once each, whatever the thread count & stage 4 path
+test_cull_counts() {
+    generate_random_scene cull 4000
+    local dir="$WORK_DIR/test-cases/cull"
+    local expected=""
+
+    for options in "--threads 1" "--threads 4" "--threads 4 --stream" "--threads 1 --pipelined" "--threads 4 --pipelined"; do
+        render cull --stats --cull back --cull-degenerate --cull-small $options || { fail "cull counts ($options): render failed"; continue; }
+
+        # stage 4 counters share one line, the only one holding trianglesSubmitted
+        local counts=""
+        for key in trianglesSubmitted trianglesCulledBack trianglesCulledDegenerate trianglesCulledSmall; do
+            counts="$counts $(stats_value "$dir/stats.json" $key trianglesSubmitted)"
+        done
+
+        if [ -z "$expected" ]; then
+            expected="$counts"
+        elif [ "$counts" == "$expected" ]; then
+            pass "cull counts ($options) match --threads 1:$counts"
+        else
+            fail "cull counts ($options) are$counts instead of$expected"
+        fi
+    done
+}
+
+write_mesh_scene() {
+    # scene $1 importing mesh file $2 (already inside its directory) once
+    printf '0.0 0.0 50.0\n0.0 0.0 0.0\n0.0 1.0 0.0\n60.0 1.0 1.0 200.0\nimport mesh %s\ninstance mesh\nend\n' "$2" > "$WORK_DIR/test-cases/$1/scene.txt"
+    printf '500 500\n-1\n-1\n-1 1\n' > "$WORK_DIR/test-cases/$1/config.txt"
+}
+
+write_ply() {
+    # little endian PLY $1 with 3 float vertices & one face whose count & int32 indices are given as bytes $2
+    {
+        printf 'ply\nformat binary_little_endian 1.0\nelement vertex 3\nproperty float x\nproperty float y\nproperty float z\n'
+        printf 'element face 1\nproperty list uchar int vertex_indices\nend_header\n'
+        printf '\000\000\000\000\000\000\000\000\000\000\000\000'
+        printf '\000\000\240\100\000\000\000\000\000\000\000\000'
+        printf '\000\000\000\000\000\000\240\100\000\000\000\000'
+        printf "$2"
+    } > "$1"
+}
+
+# malformed meshes must be rejected with a message instead of undefined conversions or huge reads
+test_malformed_meshes() {
+    local cases=(
+        "valid.ply|\\003\\000\\000\\000\\000\\001\\000\\000\\000\\002\\000\\000\\000|"
+        "negative.ply|\\003\\000\\000\\000\\000\\001\\000\\000\\000\\377\\377\\377\\377|invalid face"
+        "range.ply|\\003\\000\\000\\000\\000\\001\\000\\000\\000\\003\\000\\000\\000|invalid face"
+        "count.ply|\\377\\000\\000\\000\\000|bad PLY list count"
+    )
+
+    for entry in "${cases[@]}"; do
+        IFS='|' read -r fileName bytes message <<< "$entry"
+        local name="mesh-${fileName%.*}"
+
+        mkdir -p "$WORK_DIR/test-cases/$name"
+        write_ply "$WORK_DIR/test-cases/$name/$fileName" "$bytes"
+        write_mesh_scene "$name" "$fileName"
+        check_mesh_render "$name" "$fileName" "$message"
+    done
+
+    for faces in "f 1 2 3|" "f -1 -2 -3|" "f 1 2 4|invalid face" "f 1 2 -4|invalid face" "f 0 1 2|invalid face" "f 1 2 99999999999999999999|invalid face"; do
+        IFS='|' read -r face message <<< "$faces"
+        local name="mesh-obj-$(echo "$face" | tr -c '0-9a-z\n-' '_')"
+
+        mkdir -p "$WORK_DIR/test-cases/$name"
+        printf 'v 0 0 0\nv 5 0 0\nv 0 5 0\n%s\n' "$face" > "$WORK_DIR/test-cases/$name/mesh.obj"
+        write_mesh_scene "$name" mesh.obj
+        check_mesh_render "$name" "$face" "$message"
+    done
+}
+
+check_mesh_render() {
+    # renders scene $1 & expects success (empty $3) or failure with message $3
+    if render "$1"; then
+        if [ -z "$3" ]; then
+            pass "mesh $2 imported"
+        else
+            fail "mesh $2 accepted, expected \"$3\""
+        fi
+    elif [ -n "$3" ] && grep -q "$3" "$WORK_DIR/$1.log"; then
+        pass "mesh $2 rejected with \"$3\""
+    else
+        fail "mesh $2: $(head -1 "$WORK_DIR/$1.log")"
+    fi
+}
+
+test_hierarchical_z_output
+test_stream_output
+test_pipelined_output
+test_multisample_output
+test_tall_empty_depth_dump
+test_batch_seeds
+test_corrupt_scene_binary_fallback
+test_cull_counts
+test_triangle_count_overflow
+test_socket_path_kept
+test_malformed_meshes
+
+if [ "$FAILURES" -ne 0 ]; then
+    echo "$FAILURES check(s) failed"
+    exit 1
+fi
+echo "all checks passed"
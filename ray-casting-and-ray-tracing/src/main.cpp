@@ -10,12 +10,8 @@
 #include<windows.h>
 #include<GL/glut.h>
 
-/*
-    You will find "bitmap_image.hpp" from the following link:
-    https://drive.google.com/file/d/14eOfsMpwIuh8G_Wy6BSjNX6VXFRA9eSM/view?usp=sharing
-*/
-
-#include "bitmap_image.hpp"
+/* image output module shared with the raster based graphics pipeline */
+#include "../../raster-based-graphics-pipeline/image_writer.hpp"
 #include "header.hpp"
 
 using namespace std;
@@ -116,14 +112,21 @@ void drawAxes(double axisLength) {
 void capture() {
     cout << position << ": capturing bitmap image" << endl;
 
-    /* initializing bitmap image and setting background color */
-    bitmap_image bitmapImage(imagePixelDimension, imagePixelDimension);
+    /* initializing bitmap image file, which is written one traced row at a time */
+    /* reference: https://stackoverflow.com/questions/228005/alternative-to-itoa-for-converting-integer-to-string-c */
+    stringstream currentBitmapImageCount;
+    currentBitmapImageCount << (bitmapImageCount + 1);
 
-    for(int column=0; column<imagePixelDimension; column++) {
-        for(int row=0; row<imagePixelDimension; row++) {
-            bitmapImage.set_pixel(column, row, 0, 0, 0);  // color = black
-        }
+    ImageFile bitmapImage;
+
+    if(!bitmapImage.open("D:\\Academic 4-1\\CSE410 (Computer Graphics sessional)\\offline-3\\offline3-src\\outputs\\output"+currentBitmapImageCount.str()+".bmp", imagePixelDimension, imagePixelDimension, IMAGE_FORMAT_BMP)) {
+        cout << position << ": bitmap image could not be created" << endl;
+        return;
     }
+    /* output numbers are only used up by images actually created */
+    bitmapImageCount++;
+
+    vector<uint32_t> rowPixels(imagePixelDimension);
 
     /* computing and setting necessary parameters */
     double planeDistance = windowHeight/(2.0*tan(fovY/2.0*PI/180.0));
@@ -143,8 +146,10 @@ void capture() {
             2) https://en.cppreference.com/w/cpp/types/numeric_limits/max
     */
 
-    for(int column=0; column<imagePixelDimension; column++) {
-        for(int row=0; row<imagePixelDimension; row++) {
+    for(int row=0; row<imagePixelDimension; row++) {
+        for(int column=0; column<imagePixelDimension; column++) {
+            rowPixels[column] = 0;  // color = black
+
             /* calculating current pixel and casting ray from camera to (curPixel-camera) direction */
             Vector curPixel = topLeft+r*(column*du)-u*(row*dv);
             Ray ray(position, curPixel-position);
@@ -167,17 +172,18 @@ void capture() {
             if(nearest != INT_MAX) {
                 Color color;  // color = black
                 tMin = objects[nearest]->intersect(ray, color, 1);
-                bitmapImage.set_pixel(column, row, (int) round(color.red*255.0), (int) round(color.green*255.0), (int) round(color.blue*255.0));
+                /* packed as red | green<<8 | blue<<16, channels truncated to a byte as set_pixel() did */
+                rowPixels[column] = (uint32_t) (unsigned char) (int) round(color.red*255.0) | ((uint32_t) (unsigned char) (int) round(color.green*255.0)<<8) | ((uint32_t) (unsigned char) (int) round(color.blue*255.0)<<16);
             }
         }
+        bitmapImage.writeRow(row, &rowPixels[0]);
     }
 
     /* saving bitmap image */
-    /* reference: https://stackoverflow.com/questions/228005/alternative-to-itoa-for-converting-integer-to-string-c */
-    stringstream currentBitmapImageCount;
-    currentBitmapImageCount << (++bitmapImageCount);
-
-    bitmapImage.save_image("D:\\Academic 4-1\\CSE410 (Computer Graphics sessional)\\offline-3\\offline3-src\\outputs\\output"+currentBitmapImageCount.str()+".bmp");
+    if(!bitmapImage.close()) {
+        cout << position << ": bitmap image could not be saved" << endl;
+        return;
+    }
     cout << position << ": bitmap image captured" << endl;
 }
 